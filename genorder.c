@@ -0,0 +1,144 @@
+/*
+ genorder.c
+
+ Write the .rep trace of the free list order benchmark (make order). It is
+ random churn over ORDER_SLOTS ids, half of the requests 1 to 64 bytes and
+ the rest up to 600, 8000 and 60000 bytes, after which everything is freed.
+ Then ORDER_SMALL minimum-size blocks are allocated between live ones,
+ freed in random order and taken again, which a free list walked on each
+ insertion takes quadratic time over. The seed is fixed, so every run
+ writes the same trace.
+
+ Usage: genorder [<rep>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ORDER_SLOTS 4000        /* Ids live at once in the churn */
+#define ORDER_CHURN 120000      /* Ops of the churn */
+#define ORDER_SMALL 16000       /* Minimum-size blocks */
+#define ORDER_HEAP  20000000    /* Suggested heap size */
+
+static unsigned long long rnd;
+
+static unsigned long long next_rnd(void) {
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 7;
+    rnd ^= rnd << 17;
+    return rnd;
+}
+
+static size_t churn_size(void) {
+    unsigned long long r = next_rnd() % 100;
+
+    if (r < 50) {
+        return 1 + next_rnd() % 64;
+    }
+    if (r < 80) {
+        return 1 + next_rnd() % 600;
+    }
+    if (r < 95) {
+        return 1 + next_rnd() % 8000;
+    }
+    return 1 + next_rnd() % 60000;
+}
+
+/*
+ Write the ops to out, or only count them if out is NULL. Return the number
+ of ops and set *nids to the number of ids.
+ */
+static long generate(FILE *out, long *nids) {
+    static long slot[ORDER_SLOTS];
+    static long order[ORDER_SMALL];
+    long nid = 0, nops = 0, small, i, k, t;
+
+    rnd = 88172645463325252ULL;
+    for (i = 0; i < ORDER_SLOTS; i ++) {
+        slot[i] = -1;
+    }
+    for (k = 0; k < ORDER_CHURN; k ++) {
+        i = (long)(next_rnd() % ORDER_SLOTS);
+        if (slot[i] < 0) {
+            slot[i] = nid ++;
+            if (out != NULL) {
+                fprintf(out, "a %ld %zu\n", slot[i], churn_size());
+            } else {
+                churn_size();
+            }
+        } else {
+            if (out != NULL) {
+                fprintf(out, "f %ld\n", slot[i]);
+            }
+            slot[i] = -1;
+        }
+        nops ++;
+    }
+    for (i = 0; i < ORDER_SLOTS; i ++) {
+        if (slot[i] >= 0) {
+            if (out != NULL) {
+                fprintf(out, "f %ld\n", slot[i]);
+            }
+            nops ++;
+        }
+    }
+
+    /* Minimum-size blocks, each followed by one that stays live */
+    small = nid;
+    for (k = 0; k < ORDER_SMALL; k ++) {
+        if (out != NULL) {
+            fprintf(out, "a %ld 8\na %ld 8\n", nid, nid + 1);
+        }
+        nid += 2;
+        nops += 2;
+        order[k] = k;
+    }
+    for (k = ORDER_SMALL - 1; k > 0; k --) {
+        i = (long)(next_rnd() % (unsigned long long)(k + 1));
+        t = order[k];
+        order[k] = order[i];
+        order[i] = t;
+    }
+    for (k = 0; k < ORDER_SMALL; k ++) {
+        if (out != NULL) {
+            fprintf(out, "f %ld\n", small + 2*order[k]);
+        }
+        nops ++;
+    }
+    for (k = 0; k < ORDER_SMALL; k ++) {
+        if (out != NULL) {
+            fprintf(out, "a %ld 8\nf %ld\n", nid, nid);
+        }
+        nid ++;
+        nops += 2;
+    }
+    for (k = 0; k < ORDER_SMALL; k ++) {
+        if (out != NULL) {
+            fprintf(out, "f %ld\n", small + 2*k + 1);
+        }
+        nops ++;
+    }
+    *nids = nid;
+    return nops;
+}
+
+int main(int argc, char **argv) {
+    FILE *out = stdout;
+    long nids, nops;
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [<rep>]\n", argv[0]);
+        return 2;
+    }
+    if (argc == 2 && (out = fopen(argv[1], "w")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    nops = generate(NULL, &nids);
+    fprintf(out, "%d\n%ld\n%ld\n1\n", ORDER_HEAP, nids, nops);
+    generate(out, &nids);
+    if (out != stdout && fclose(out) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,456 @@
+/*
+ mdriver.c
+
+ Replay .rep traces against the allocator linked in and report, for each
+ trace, whether it ran correctly, its throughput and its peak utilization.
+
+ A trace is a header of four numbers, the suggested heap size (ignored),
+ the number of ids, the number of ops and a weight (ignored), followed by
+ one op per line:
+
+     a <id> <bytes>    malloc
+     r <id> <bytes>    realloc
+     f <id>            free
+
+ Each trace runs on a fresh heap (mem_reset_brk(), then mm_init()) three
+ ways:
+ 1. A checked run. Every block must be aligned and inside the heap, and
+    must keep the bytes written to it until it is freed, which catches
+    overlapping blocks. realloc() must keep the old bytes.
+ 2. A run that tracks the peak of the payload bytes in use. Utilization is
+    that peak over the size of the heap at the end. The faults column is
+    the minor page faults this run takes, which counts the pages it touches
+    with a backend that gives pages back (mmap); with sim the pages of an
+    earlier run stay in, so only new ones are counted.
+ 3. Timed runs without checks, repeated until they take MIN_SECS, for
+    ops per second. The os column is the part of that time the backend of
+    memlib spent committing memory.
+
+ Usage: mdriver [-b <backend>] [-c] [-d <depth>] [-o <csv>] <trace>...
+   -b backend heap backend of memlib: sim (default), mmap, mmap-populate
+              or sbrk
+   -c         call mm_checkheap() after every op of the checked run
+   -d depth   set the fit depth of an allocator with mm_set_fit_depth()
+   -o csv     append a line per trace to a CSV file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#ifndef ALLOCATOR
+#define ALLOCATOR "mm"  /* Name of the allocator in the results */
+#endif
+
+#define ALIGNMENT 8     /* Payloads must be aligned to this */
+#define MIN_SECS  0.2   /* Least time the timed runs of a trace take */
+
+/* Only some allocators can tune their fit */
+#pragma weak mm_set_fit_depth
+
+typedef struct op {
+    char type;      /* 'a', 'r' or 'f' */
+    int id;
+    size_t size;
+} op_t;
+
+typedef struct trace {
+    int nids;
+    int nops;
+    op_t *ops;
+    char **blocks;  /* Block of each id */
+    size_t *sizes;  /* Payload bytes of each id */
+} trace_t;
+
+typedef struct result {
+    int valid;
+    double secs;    /* Time of one run */
+    double os_secs; /* Of secs, time the backend spent committing memory */
+    double util;    /* Peak payload over heap size */
+    long minflt;    /* Minor page faults of the utilization run */
+} result_t;
+
+static int check_heap = 0;
+
+/*
+ Read a trace. Return NULL if the file cannot be read or is malformed.
+ */
+static trace_t *read_trace(const char *path) {
+    FILE *f;
+    trace_t *t;
+    int i, weight;
+    long heap;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        perror(path);
+        return NULL;
+    }
+    t = calloc(1, sizeof(trace_t));
+    if (fscanf(f, "%ld %d %d %d", &heap, &t->nids, &t->nops, &weight) != 4 ||
+        t->nids < 0 || t->nops < 0) {
+        fprintf(stderr, "%s: bad header\n", path);
+        fclose(f);
+        free(t);
+        return NULL;
+    }
+    t->ops = calloc(t->nops + 1, sizeof(op_t));
+    t->blocks = calloc(t->nids + 1, sizeof(char *));
+    t->sizes = calloc(t->nids + 1, sizeof(size_t));
+    for (i = 0; i < t->nops; i ++) {
+        op_t *op = &t->ops[i];
+        char type[2];
+        int n;
+
+        if (fscanf(f, "%1s %d", type, &op->id) != 2) {
+            break;
+        }
+        op->type = type[0];
+        n = 1;
+        if (op->type == 'a' || op->type == 'r') {
+            n = fscanf(f, "%zu", &op->size);
+        }
+        if (n != 1 || op->id < 0 || op->id >= t->nids ||
+            (op->type != 'a' && op->type != 'r' && op->type != 'f')) {
+            break;
+        }
+    }
+    fclose(f);
+    if (i < t->nops) {
+        fprintf(stderr, "%s: bad op %d\n", path, i + 1);
+        free(t->ops);
+        free(t->blocks);
+        free(t->sizes);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+static void free_trace(trace_t *t) {
+    free(t->ops);
+    free(t->blocks);
+    free(t->sizes);
+    free(t);
+}
+
+/*
+ Empty the heap for the next run. Return 0 on success.
+ */
+static int reset_heap(trace_t *t) {
+    mem_reset_brk();
+    memset(t->blocks, 0, t->nids * sizeof(char *));
+    memset(t->sizes, 0, t->nids * sizeof(size_t));
+    return mm_init();
+}
+
+/* Byte written to every payload byte of the block of id */
+static unsigned char fill_byte(int id) {
+    return (unsigned char)(id * 131 + 7);
+}
+
+/*
+ Check that a new block of size bytes is aligned and inside the heap
+ */
+static int check_block(const char *name, int i, char *p, size_t size) {
+    if (p == NULL) {
+        if (size == 0) {
+            return 1;
+        }
+        printf("%s: op %d: out of memory\n", name, i + 1);
+        return 0;
+    }
+    if ((size_t)p % ALIGNMENT != 0) {
+        printf("%s: op %d: payload %p not aligned\n", name, i + 1, p);
+        return 0;
+    }
+    if (p < (char *)mem_heap_lo() ||
+        (size > 0 && p + size - 1 > (char *)mem_heap_hi())) {
+        printf("%s: op %d: payload %p of %zu bytes outside the heap\n",
+            name, i + 1, p, size);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ Check that the first size bytes of the block of id still hold its fill
+ */
+static int check_fill(const char *name, int i, trace_t *t, int id,
+    size_t size) {
+    unsigned char b = fill_byte(id);
+    size_t k;
+
+    for (k = 0; k < size; k ++) {
+        if ((unsigned char)t->blocks[id][k] != b) {
+            printf("%s: op %d: byte %zu of id %d was overwritten\n",
+                name, i + 1, k, id);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ Replay t once, checking every block. Return 1 if the allocator is correct.
+ */
+static int run_checked(const char *name, trace_t *t) {
+    int i;
+
+    if (reset_heap(t) < 0) {
+        printf("%s: mm_init failed\n", name);
+        return 0;
+    }
+    for (i = 0; i < t->nops; i ++) {
+        op_t *op = &t->ops[i];
+        char *p;
+
+        switch (op->type) {
+        case 'a':
+            p = mm_malloc(op->size);
+            if (!check_block(name, i, p, op->size)) {
+                return 0;
+            }
+            memset(p, fill_byte(op->id), op->size);
+            t->blocks[op->id] = p;
+            t->sizes[op->id] = op->size;
+            break;
+        case 'r':
+            if (!check_fill(name, i, t, op->id, t->sizes[op->id])) {
+                return 0;
+            }
+            p = mm_realloc(t->blocks[op->id], op->size);
+            if (!check_block(name, i, p, op->size)) {
+                return 0;
+            }
+            t->blocks[op->id] = p;
+            if (!check_fill(name, i, t, op->id,
+                op->size < t->sizes[op->id] ? op->size : t->sizes[op->id])) {
+                return 0;
+            }
+            memset(p, fill_byte(op->id), op->size);
+            t->sizes[op->id] = op->size;
+            break;
+        case 'f':
+            if (!check_fill(name, i, t, op->id, t->sizes[op->id])) {
+                return 0;
+            }
+            mm_free(t->blocks[op->id]);
+            t->blocks[op->id] = NULL;
+            t->sizes[op->id] = 0;
+            break;
+        }
+        if (check_heap) {
+            mm_checkheap(i + 1);
+        }
+    }
+    return 1;
+}
+
+/* Minor page faults the process has taken */
+static long minor_faults(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+/*
+ Replay t once and return the peak of payload bytes in use over the size of
+ the heap at the end. The minor page faults of the run are stored in
+ *minflt.
+ */
+static double run_util(trace_t *t, long *minflt) {
+    size_t live = 0, peak = 0;
+    long faults;
+    int i;
+
+    reset_heap(t);
+    faults = minor_faults();
+    for (i = 0; i < t->nops; i ++) {
+        op_t *op = &t->ops[i];
+
+        switch (op->type) {
+        case 'a':
+            t->blocks[op->id] = mm_malloc(op->size);
+            live += op->size;
+            break;
+        case 'r':
+            t->blocks[op->id] = mm_realloc(t->blocks[op->id], op->size);
+            live += op->size - t->sizes[op->id];
+            break;
+        case 'f':
+            mm_free(t->blocks[op->id]);
+            live -= t->sizes[op->id];
+            break;
+        }
+        t->sizes[op->id] = op->type == 'f' ? 0 : op->size;
+        peak = live > peak ? live : peak;
+    }
+    *minflt = minor_faults() - faults;
+    return mem_heapsize() > 0 ? (double)peak / mem_heapsize() : 0.0;
+}
+
+/*
+ Replay t without checks and return the time it took in seconds. The part
+ the backend spent committing memory is added to os_secs.
+ */
+static double run_timed(trace_t *t, double *os_secs) {
+    struct timespec start, end;
+    double os;
+    int i;
+
+    reset_heap(t);
+    os = mem_os_secs();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < t->nops; i ++) {
+        op_t *op = &t->ops[i];
+
+        switch (op->type) {
+        case 'a':
+            t->blocks[op->id] = mm_malloc(op->size);
+            break;
+        case 'r':
+            t->blocks[op->id] = mm_realloc(t->blocks[op->id], op->size);
+            break;
+        case 'f':
+            mm_free(t->blocks[op->id]);
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *os_secs += mem_os_secs() - os;
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+}
+
+int main(int argc, char **argv) {
+    const char *csv = NULL;
+    FILE *out = NULL;
+    int depth = 0, ntraces = 0, nvalid = 0, c, k;
+    double total_secs = 0, total_os = 0, total_util = 0;
+    long total_ops = 0, total_minflt = 0;
+
+    while ((c = getopt(argc, argv, "b:cd:o:")) != -1) {
+        switch (c) {
+        case 'b':
+            if (mem_set_backend(optarg) < 0) {
+                fprintf(stderr, "%s: unknown backend %s\n", argv[0], optarg);
+                return 2;
+            }
+            break;
+        case 'c':
+            check_heap = 1;
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        default:
+            fprintf(stderr,
+                "usage: %s [-b <backend>] [-c] [-d <depth>] [-o <csv>] "
+                "<trace>...\n", argv[0]);
+            return 2;
+        }
+    }
+    /* The sbrk backend needs the break to itself, so the heap is set up
+    before anything is allocated and the C library maps all its memory */
+    mem_init();
+    if (strcmp(mem_backend_name(), "sbrk") == 0) {
+        mallopt(M_MMAP_THRESHOLD, 0);
+    }
+    if (optind == argc) {
+        fprintf(stderr, "%s: no traces\n", argv[0]);
+        return 2;
+    }
+    if (depth > 0) {
+        if (mm_set_fit_depth == NULL) {
+            fprintf(stderr, "%s: %s has no fit depth\n", argv[0], ALLOCATOR);
+            return 2;
+        }
+        mm_set_fit_depth(depth);
+    }
+    if (csv != NULL) {
+        if ((out = fopen(csv, "a")) == NULL) {
+            perror(csv);
+            return 1;
+        }
+        if (ftell(out) == 0) {
+            fprintf(out,
+                "allocator,fit_depth,trace,valid,ops,secs,ops_per_sec,util,"
+                "backend,os_secs,minflt\n");
+        }
+    }
+
+    printf("Results for %s", ALLOCATOR);
+    if (mm_set_fit_depth != NULL) {
+        /* Read the depth back by setting it */
+        depth = mm_set_fit_depth(1);
+        mm_set_fit_depth(depth);
+        printf(" (fit depth %d)", depth);
+    }
+    printf(" on %s:\n%-24s %5s %9s %10s %12s %6s %9s %8s\n",
+        mem_backend_name(), "trace", "valid", "ops", "secs", "ops/sec", "util",
+        "os", "faults");
+
+    for (k = optind; k < argc; k ++) {
+        trace_t *t = read_trace(argv[k]);
+        const char *name = strrchr(argv[k], '/') ?
+            strrchr(argv[k], '/') + 1 : argv[k];
+        result_t r = {0, 0.0, 0.0, 0.0, 0};
+
+        if (t == NULL) {
+            continue;
+        }
+        ntraces ++;
+        r.valid = run_checked(name, t);
+        if (r.valid) {
+            double spent = 0;
+            int reps = 0;
+
+            r.util = run_util(t, &r.minflt);
+            do {
+                spent += run_timed(t, &r.os_secs);
+                reps ++;
+            } while (spent < MIN_SECS);
+            r.secs = spent / reps;
+            r.os_secs /= reps;
+            nvalid ++;
+            total_ops += t->nops;
+            total_secs += r.secs;
+            total_os += r.os_secs;
+            total_util += r.util;
+            total_minflt += r.minflt;
+            printf("%-24s %5s %9d %10.6f %12.0f %5.1f%% %9.6f %8ld\n", name,
+                "yes", t->nops, r.secs, r.secs > 0 ? t->nops / r.secs : 0.0,
+                100 * r.util, r.os_secs, r.minflt);
+        } else {
+            printf("%-24s %5s %9d\n", name, "no", t->nops);
+        }
+        if (out != NULL) {
+            fprintf(out, "%s,%d,%s,%d,%d,%.9f,%.0f,%.4f,%s,%.9f,%ld\n",
+                ALLOCATOR, mm_set_fit_depth != NULL ? depth : 0, name, r.valid,
+                t->nops, r.secs, r.secs > 0 ? t->nops / r.secs : 0.0, r.util,
+                mem_backend_name(), r.os_secs, r.minflt);
+        }
+        free_trace(t);
+    }
+
+    if (nvalid > 0) {
+        printf("%-24s %5s %9ld %10.6f %12.0f %5.1f%% %9.6f %8ld\n", "Total",
+            nvalid == ntraces ? "yes" : "no", total_ops, total_secs,
+            total_secs > 0 ? total_ops / total_secs : 0.0,
+            100 * total_util / nvalid, total_os, total_minflt);
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+    mem_deinit();
+    return nvalid == ntraces ? 0 : 1;
+}
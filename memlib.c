@@ -0,0 +1,397 @@
+/*
+ memlib.c
+
+ The heap under mem_sbrk(). mem_init() reserves MAX_HEAP bytes of address
+ space, and mem_sbrk() moves a break up through it like sbrk(), so the
+ driver can count every byte an allocator asks for. Where the memory comes
+ from is up to a backend, picked by name with mem_set_backend() or the
+ MM_BACKEND environment variable before mem_init():
+
+     sim            One mapping of the whole reservation, readable and
+                    writable from the start. Pages are committed when they
+                    are first touched, and are kept when the break goes
+                    down, by mem_reset_brk() or a negative mem_sbrk(). This
+                    is the default.
+     mmap           The reservation is mapped PROT_NONE with MAP_NORESERVE,
+                    and the break commits it COMMIT_CHUNK bytes at a time by
+                    mapping read-write memory over it. The pages above the
+                    break are given back when it goes down, so every run
+                    of the driver faults its pages in again.
+     mmap-populate  As mmap, but with MAP_POPULATE, so the pages are faulted
+                    in by the commit instead of on first touch.
+     sbrk           The process break, grown with sbrk(). Only works while
+                    nothing else moves the break, as in the interposing
+                    build where mm.c is the only malloc.
+
+ Committing and giving back memory is timed, and mem_os_secs() returns the
+ total, so the cost of page faults taken by mmap-populate can be told apart
+ from the allocator's own.
+
+ mem_zero_lo() returns a mark above which the heap is known to be zero: it
+ is the highest break so far, and it comes down to where a backend gave
+ pages back. An allocator can skip clearing memory the break hands out
+ above it.
+
+ mem_sbrk() sets the heap up on first use if mem_init() was not called, as
+ in the interposing build. It is not thread-safe; mm.c only calls it under
+ the lock of arena 0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+
+#define MAX_HEAP (1UL << 32) /* Most bytes mem_sbrk() hands out */
+#define COMMIT_CHUNK (1UL << 16) /* Least bytes committed at a time */
+
+typedef struct mem_backend {
+    const char *name;
+    /* Reserve max bytes and return the start, or NULL */
+    char *(*reserve)(size_t max);
+    /* Make [lo, hi) usable and return 0, or -1. NULL if there is nothing
+    to do. */
+    int (*commit)(char *lo, char *hi);
+    /* Give [lo, hi) back. NULL to keep the pages. */
+    void (*decommit)(char *lo, char *hi);
+    /* Undo reserve(). NULL if decommit() of all the heap does it. */
+    void (*release)(char *start, size_t max);
+} mem_backend_t;
+
+static char *sim_reserve(size_t max);
+static char *mmap_reserve(size_t max);
+static int mmap_commit(char *lo, char *hi);
+static int populate_commit(char *lo, char *hi);
+static void mmap_decommit(char *lo, char *hi);
+static void mmap_release(char *start, size_t max);
+static char *sbrk_reserve(size_t max);
+static int sbrk_commit(char *lo, char *hi);
+static void sbrk_decommit(char *lo, char *hi);
+
+static const mem_backend_t backends[] = {
+    {"sim", sim_reserve, NULL, NULL, mmap_release},
+    {"mmap", mmap_reserve, mmap_commit, mmap_decommit, mmap_release},
+    {"mmap-populate", mmap_reserve, populate_commit, mmap_decommit,
+        mmap_release},
+    {"sbrk", sbrk_reserve, sbrk_commit, sbrk_decommit, NULL},
+};
+#define NBACKENDS (int)(sizeof(backends) / sizeof(backends[0]))
+
+static const mem_backend_t *backend = NULL; /* NULL until one is picked */
+
+static char *mem_start_brk;  /* Points to first byte of heap */
+static char *mem_brk;        /* Points to last byte of heap plus 1 */
+static char *mem_max_addr;   /* Max legal heap addr plus 1 */
+static char *mem_top;        /* End of the committed part of the heap */
+static char *mem_zero;       /* The heap above is zero */
+static double os_secs = 0;   /* Time spent committing and giving back */
+
+static char *sim_reserve(size_t max) {
+    char *p = mmap(NULL, max, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static char *mmap_reserve(size_t max) {
+    char *p = mmap(NULL, max, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+ Map read-write memory over [lo, hi) of the reservation, with extra flags
+ */
+static int map_fixed(char *lo, char *hi, int flags) {
+    void *p = mmap(lo, hi - lo, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | flags, -1, 0);
+
+    return p == MAP_FAILED ? -1 : 0;
+}
+
+static int mmap_commit(char *lo, char *hi) {
+    return map_fixed(lo, hi, 0);
+}
+
+static int populate_commit(char *lo, char *hi) {
+    return map_fixed(lo, hi, MAP_POPULATE);
+}
+
+/*
+ Put [lo, hi) back to reserved, which drops its pages and commit charge
+ */
+static void mmap_decommit(char *lo, char *hi) {
+    mmap(lo, hi - lo, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+}
+
+static void mmap_release(char *start, size_t max) {
+    munmap(start, max);
+}
+
+/*
+ Start the heap at the current break, moved up to a page boundary
+ */
+static char *sbrk_reserve(size_t max) {
+    char *p = sbrk(0);
+    size_t pad = -(uintptr_t)p & (mem_pagesize() - 1);
+
+    (void)max;
+    if (p == (char *)-1 || (pad > 0 && sbrk(pad) != p)) {
+        return NULL;
+    }
+    return p + pad;
+}
+
+/*
+ Move the break from lo to hi. Fails if someone else has moved it, as the
+ heap must stay contiguous.
+ */
+static int sbrk_commit(char *lo, char *hi) {
+    char *p = sbrk(hi - lo);
+
+    if (p == (char *)-1) {
+        return -1;
+    }
+    if (p != lo) {
+        sbrk(-(hi - lo));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ Move the break from hi back to lo, unless someone else has moved it
+ */
+static void sbrk_decommit(char *lo, char *hi) {
+    if (sbrk(0) == hi) {
+        sbrk(-(hi - lo));
+    }
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ Pick the backend of the heap by name. Return -1 if there is no such
+ backend or the heap is already set up.
+ */
+int mem_set_backend(const char *name) {
+    int i;
+
+    if (mem_start_brk != NULL) {
+        return -1;
+    }
+    for (i = 0; i < NBACKENDS; i ++) {
+        if (strcmp(backends[i].name, name) == 0) {
+            backend = &backends[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ Name of the backend of the heap
+ */
+const char *mem_backend_name(void) {
+    return backend != NULL ? backend->name : backends[0].name;
+}
+
+/*
+ Set up the heap with the backend picked, MM_BACKEND or the default.
+ Return -1 if it cannot be.
+ */
+static int mem_setup(void) {
+    const char *name;
+
+    if (backend == NULL) {
+        name = getenv("MM_BACKEND");
+        if (name == NULL || mem_set_backend(name) < 0) {
+            backend = &backends[0];
+        }
+    }
+    if ((mem_start_brk = backend->reserve(MAX_HEAP)) == NULL) {
+        return -1;
+    }
+    mem_brk = mem_start_brk;
+    mem_top = mem_start_brk;
+    mem_zero = mem_start_brk;
+    mem_max_addr = mem_start_brk + MAX_HEAP;
+    return 0;
+}
+
+/*
+ Reserve the address space of the heap. Exits if it cannot.
+ */
+void mem_init(void) {
+    const char *name = getenv("MM_BACKEND");
+
+    if (backend == NULL && name != NULL && mem_set_backend(name) < 0) {
+        fprintf(stderr, "mem_init: unknown MM_BACKEND %s\n", name);
+        exit(1);
+    }
+    if (mem_start_brk == NULL && mem_setup() < 0) {
+        fprintf(stderr, "mem_init: cannot reserve the heap with %s\n",
+            mem_backend_name());
+        exit(1);
+    }
+}
+
+/*
+ Give the heap back to the OS
+ */
+void mem_deinit(void) {
+    if (mem_start_brk == NULL) {
+        return;
+    }
+    if (backend->release != NULL) {
+        backend->release(mem_start_brk, MAX_HEAP);
+    } else if (backend->decommit != NULL) {
+        backend->decommit(mem_start_brk, mem_top);
+    }
+    mem_start_brk = NULL;
+    mem_zero = NULL;
+}
+
+/*
+ Reset the break to the start of the heap, so the heap is empty. With sim
+ the pages keep whatever the last trace wrote to them; the other backends
+ give them back.
+ */
+void mem_reset_brk(void) {
+    if (backend != NULL && backend->decommit != NULL &&
+        mem_top > mem_start_brk) {
+        double t = now();
+        backend->decommit(mem_start_brk, mem_top);
+        os_secs += now() - t;
+        mem_top = mem_start_brk;
+        mem_zero = mem_start_brk;
+    }
+    mem_brk = mem_start_brk;
+}
+
+/*
+ Commit the heap up to at least end. Return -1 if the backend fails.
+ */
+static int mem_commit(char *end) {
+    size_t n = (end - mem_start_brk + COMMIT_CHUNK - 1) & ~(COMMIT_CHUNK - 1);
+    char *hi = mem_start_brk + n;
+
+    if (hi > mem_max_addr) {
+        hi = mem_max_addr;
+    }
+    if (backend->commit != NULL) {
+        double t = now();
+        int rt = backend->commit(mem_top, hi);
+        os_secs += now() - t;
+        if (rt < 0) {
+            return -1;
+        }
+    }
+    mem_top = hi;
+    return 0;
+}
+
+/*
+ Lower the break to end. The whole pages above it are given back if the
+ backend gives pages back.
+ */
+static void mem_shrink(char *end) {
+    uintptr_t page = mem_pagesize();
+    char *lo = (char *)(((uintptr_t)end + page - 1) & ~(page - 1));
+
+    if (backend->decommit != NULL && lo < mem_top) {
+        double t = now();
+        backend->decommit(lo, mem_top);
+        os_secs += now() - t;
+        mem_top = lo;
+        if (lo < mem_zero) {
+            mem_zero = lo;
+        }
+    }
+    mem_brk = end;
+}
+
+/*
+ Move the break by incr bytes and return the old break, like sbrk(). A
+ negative incr shrinks the heap. If the break would leave the reserved
+ space or the memory cannot be committed, errno is set to ENOMEM and
+ (void *)-1 is returned.
+ */
+void *mem_sbrk(int incr) {
+    char *old_brk;
+
+    if ((mem_start_brk == NULL && mem_setup() < 0) ||
+        (incr < 0 &&
+        (size_t)-(long)incr > (size_t)(mem_brk - mem_start_brk)) ||
+        (incr > 0 && (size_t)incr > (size_t)(mem_max_addr - mem_brk)) ||
+        (mem_brk + incr > mem_top && mem_commit(mem_brk + incr) < 0)) {
+        errno = ENOMEM;
+        return (void *)-1;
+    }
+    old_brk = mem_brk;
+    if (incr < 0) {
+        mem_shrink(mem_brk + incr);
+    } else {
+        mem_brk += incr;
+        if (mem_brk > mem_zero) {
+            mem_zero = mem_brk;
+        }
+    }
+    return (void *)old_brk;
+}
+
+/*
+ Return the address above which the heap is zero, or NULL before the heap
+ is set up. Memory above it was never handed out by the break, or was
+ given back since. With sim no page is given back, so it is the highest
+ break so far.
+ */
+void *mem_zero_lo(void) {
+    return (void *)mem_zero;
+}
+
+/*
+ Seconds spent by the backend committing memory and giving it back
+ */
+double mem_os_secs(void) {
+    return os_secs;
+}
+
+/*
+ Address of the first heap byte
+ */
+void *mem_heap_lo(void) {
+    return (void *)mem_start_brk;
+}
+
+/*
+ Address of the last heap byte
+ */
+void *mem_heap_hi(void) {
+    return (void *)(mem_brk - 1);
+}
+
+/*
+ Size of the heap in bytes
+ */
+size_t mem_heapsize(void) {
+    return (size_t)(mem_brk - mem_start_brk);
+}
+
+/*
+ Size of a page of the system
+ */
+size_t mem_pagesize(void) {
+    return (size_t)getpagesize();
+}
@@ -0,0 +1,16 @@
+#include <unistd.h>
+
+void mem_init(void);
+void mem_deinit(void);
+void *mem_sbrk(int incr);
+void mem_reset_brk(void);
+void *mem_heap_lo(void);
+void *mem_heap_hi(void);
+size_t mem_heapsize(void);
+size_t mem_pagesize(void);
+void *mem_zero_lo(void);
+
+/* Backend of the heap: "sim", "mmap", "mmap-populate" or "sbrk" */
+int mem_set_backend(const char *name);
+const char *mem_backend_name(void);
+double mem_os_secs(void);
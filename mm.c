@@ -40,24 +40,174 @@
 
  Segregated list is organized as follows:
  seg_header_i --> block --> block --> tail
- The i-level seglist (i starts from 0) contains blocks whose size 
- is [ 16 << i, 16 << (i+1) ) except for the last level seglist which 
- contains block with size to infinity.
+ The i-level seglist (i starts from 0) contains blocks whose size
+ is [ 16 << i, 16 << (i+1) ) except for the last level seglist which
+ contains block with size to infinity. A bitmap (seg_map) records which
+ levels are non-empty, so find_fit() jumps to the lowest non-empty level
+ above the level of a request instead of walking every seg_header. Within a
+ level find_fit() takes the smallest of the first fit_depth blocks that fit
+ (FIT_DEPTH, or mm_set_fit_depth()), and stops early on an exact fit.
+
+ The last level is not a list but a red-black tree keyed by size and then
+ address, whose root offset is kept in its seg_header. A block in the tree
+ is |HDR|LEFT|RIGHT|PARENT|COLOR|...|FTR|, which fits as the level starts
+ at 64 KB. find_fit() takes the best fit of the tree in O(log n) however
+ many large blocks are free.
+
+ Define ADDR_ORDER to keep the lists in address order instead of pushing
+ freed blocks at the head, so that allocations pack towards the bottom of
+ the heap. The position of a block is found with a skip list per level:
+ a block is linked into up to SKIP_TIERS tiers after SUCC and PRED, chosen
+ by a hash of its address, and the heads of the tiers are kept in the
+ arena. A block of the minimum size has no room for a tower, so the levels
+ below ADDR_MIN, which hold them, stay LIFO rather than be walked.
+
+ Define TLSF to replace the seglist with a two-level segregated fit index
+ over the same blocks. Each power-of-two level is split into TLSF_SL lists
+ of equal width, and a bitmap per level plus seg_map over the levels find
+ the lowest non-empty list in two find-first-set steps. A request is
+ rounded up to the next list boundary, so the head of that list always
+ fits: malloc and free take constant time at the cost of some internal
+ fragmentation. The seg_headers of all TLSF_FL * TLSF_SL lists take the
+ place of the 13 seg_headers in the heap.
+
+ Freed blocks below QUICK_MAX_ASIZE are not coalesced right away but kept,
+ still marked allocated, on a quick list of their exact size, so that a
+ loop of malloc and free of one size does not split and merge the same
+ block over and over. The quick lists are swept into the seglist when a
+ request finds no fit or they grow past QUICK_LIMIT bytes. Define NO_QUICK
+ to coalesce every block at once.
+
+ posix_memalign(), aligned_alloc() and memalign() carve a block whose
+ pointer is aligned out of a free block, and give the fragment in front of
+ it back to the seglist as a free block.
+
+ mm_malloc_batch() carves a group of blocks of one size out of a single free
+ span, and mm_free_batch() frees a group in address order, joining blocks
+ that lie behind each other so each run is coalesced once.
+
+ Requests of at least mmap_threshold bytes (mm_set_mmap_threshold()) get a
+ mapping of their own, which free() unmaps. The header of such a block has
+ the MMAPPED bit set, and the length is stored in front of it. The size of
+ the header is 0 unless the block was aligned, when it is the bytes of the
+ mapping in front of the length. The block is never in a heap, so
+ coalesce() and the heap checker never see it.
+ The driver build maps nothing unless asked to.
+
+ mm_trim() gives free memory back to the OS. Every heap is cut down right
+ after its last allocated block; arena 0 lowers the break of memlib with a
+ negative mem_sbrk(). The whole pages inside large free blocks are dropped
+ with madvise(), and the block is marked TRIMMED until its header is
+ rewritten.
+
+ mm_stats() reports the bytes in use, the footprint and its peak, the free
+ blocks per seglist level and counts of requests by size, splits, merges and
+ heap extensions. Each thread counts its requests in its cache and each arena
+ its splits and merges under its lock, so no counter is shared on the hot
+ path. The free blocks are counted by walking the seglists when asked.
+ Define NO_STATS to leave all of the counters out.
+
+ Define TRACE to build in a recorder of every call. mm_trace_start() has
+ each thread write binary records to a chunk of its own, and a writer thread
+ appends full chunks to the trace file. Each record takes a number from a
+ counter shared by all threads, which orders the calls exactly, and
+ trace2rep replays the records in that order into a .rep file for the
+ driver.
+
+ Define PROFILE to build in a sampling heap profiler. Each thread counts
+ down the bytes it allocates from a random interval of prof_rate bytes on
+ average (mm_profile_rate(), 512 KB by default), and the allocation that
+ crosses zero has its call stack taken with backtrace() and is kept in a
+ table of live samples until it is freed. Other calls cost one subtraction,
+ and a free() one byte of a filter indexed by the pointer. mm_profile_dump()
+ writes the live samples per call stack as a heap profile that pprof reads,
+ and mm_profile_signal() has a signal dump one.
+
+ mm_verify_step() checks the heap a bounded slice at a time, for builds
+ that must catch corruption without stopping: each call checks the next
+ blocks from a cursor in one arena and the next free blocks of one seglist
+ level, and returns the errors it finds instead of printing them. Merges
+ that swallow the block under a cursor move the cursor back to the merged
+ block. mm_verify() checks every heap in full; it cuts the blocks of a heap
+ into pieces with one walk over the headers, then threads check the pieces
+ and the seglist levels at once.
+
+ Each heap keeps a mark, clean_lo, above which no block has ever been
+ allocated since the memory came zero from the OS. Which memory came zero
+ is known from zero_lo, kept by the arena for a region of its own and by
+ memlib, through mem_zero_lo(), for arena 0. calloc() only clears the
+ part of its block below the mark and the fields of the free block it was
+ carved from. It also skips the whole pages inside a free block marked
+ TRIMMED, as mm_trim() gave them back and they come back zero; splitting or
+ merging the block rewrites its header and drops the mark.
+
+ Requests of at most SLAB_MAX bytes do not get a block. They get a headerless
+ slot in a slab run, a page carved out of the heap as one allocated block
+ and cut into slots of one size. free() finds out whether a pointer is a
+ slot from the page map, a radix tree over page numbers, before it looks at
+ HDRP(). Define NO_SLAB to serve every request with a block.
+
+ When built with MM_THREADS (the default for the interposing build), there
+ are up to MAX_ARENAS arenas. Each arena is a complete heap as above with its
+ own lock, in a region small enough for its 4-byte offsets. Once the arena of
+ a thread and arena 0 are full, requests spill into overflow arenas, up to
+ MAX_REGIONS in all, so the process is not held to one region. Define
+ WIDE_FIELDS to make every field of a block 8 bytes instead, for heaps and
+ blocks beyond 4 GB: the minimum block is then 32 bytes and each region is
+ 64 GB. A thread is bound to the arena with the fewest threads and moves when
+ it finds its arena locked by someone else. A freed block always goes back to
+ the arena whose region contains it.
+ In front of the arenas every thread keeps a cache of magazines, one per
+ exact block size of the level 0-4 seglists. A block freed into a magazine
+ stays marked as allocated in the heap, so a later malloc of the same size
+ pops it without find_fit(), place() or coalesce(). Magazines are refilled
+ from and spilled to the arenas in batches so that a lock is taken once per
+ batch.
  */
+#define _GNU_SOURCE /* mremap() */
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include "mm.h"
 #include "memlib.h"
 
+/* The interposing build serves a multi-threaded process (the proxy), while
+the driver build is single-threaded. Define NO_THREADS to drop the locking
+and the thread cache from the interposing build. */
+#if !defined(DRIVER) && !defined(NO_THREADS) && !defined(MM_THREADS)
+#define MM_THREADS
+#endif
+
+#if defined(MM_THREADS) || defined(TRACE) || defined(PROFILE)
+#include <pthread.h>
+#endif
+#if defined(TRACE) || defined(PROFILE)
+#include <fcntl.h>
+#include <time.h>
+#endif
+#ifdef PROFILE
+#include <execinfo.h>
+#include <signal.h>
+#include <stdarg.h>
+#endif
+
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
 
 // #define DEBUG
 #ifdef DEBUG
+/* Define DEBUG_BYTES alone for the garbled bytes check without the heap
+check and output of every call */
+# ifndef DEBUG_BYTES
+#  define DEBUG_BYTES
+# endif
 # define dbg_printf(...) printf(__VA_ARGS__)
 # define dbg_checkheap(...) checkheap(__VA_ARGS__)
 #else
@@ -75,6 +225,12 @@
 #define calloc mm_calloc
 #endif /* def DRIVER */
 
+#ifdef DRIVER
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define memalign mm_memalign
+#endif
+
 /* 8-byte alignment */
 #define ALIGNMENT 8
 
@@ -82,30 +238,85 @@
 #define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
 
 /* Basic constants and macros */
+#ifdef WIDE_FIELDS
+/* Heaps and blocks beyond 4 GB: 8-byte headers, footers and offsets */
+typedef unsigned long long word_t;
+#define FSIZE       8       /* Size of each field in a block (bytes) */
+#define WORD_MSB(x) (63 - __builtin_clzll(x)) /* Highest set bit of a word */
+#define WORD_CTZ(x) __builtin_ctzll(x)        /* Lowest set bit of a word */
+#else
+typedef unsigned int word_t;
 #define FSIZE       4       /* Size of each field in a block (bytes) */
+#define WORD_MSB(x) (31 - __builtin_clz(x))
+#define WORD_CTZ(x) __builtin_ctz(x)
+#endif
+#define MAX_BLOCK   ((size_t)(word_t)~0x7) /* Largest size a header holds */
 #define CHUNKSIZE  (1<<9)  /* Extend heap by this amount (bytes) */
+#define BATCH_SPAN  (1<<16) /* Most bytes mm_malloc_batch() carves at once */
+#define MAX_ALIGN   (1<<30) /* Alignments must be smaller, and aligned sizes
+                               to be carved from a heap */
+#define PAGE_SHIFT  12
+#define PAGE_SIZE   (1<<PAGE_SHIFT)
+#define PAGE_DOWN(p) ((uintptr_t)(p) & ~(uintptr_t)(PAGE_SIZE - 1))
+#define PAGE_UP(p)   PAGE_DOWN((uintptr_t)(p) + PAGE_SIZE - 1)
+#define CALLOC_BLOCK_MIN (1<<12) /* Smaller calloc() is malloc() and memset() */
+#define ZERO_PAGES_MIN   (1<<17) /* Larger calloc() drops pages to zero them */
+#define MMAP_THRESHOLD   (1<<20) /* Default size of requests that are mapped */
+#define MMAP_HDR    (4*FSIZE) /* Bytes of a mapping in front of the payload */
+#ifndef FIT_DEPTH
+#define FIT_DEPTH   8       /* Fitting blocks compared by find_fit() */
+#endif
 #define N_SEGLIST   13      /* Number of different level of seglists. Should be 
 an odd number to guarantee alignment of heap*/
 
+#ifdef TLSF
+/* Two-level segregated fit: first level i > 0 holds blocks of size 
+[128 << i, 256 << i) split into TLSF_SL lists of equal width, and first 
+level 0 holds blocks smaller than TLSF_SMALL in lists 16 bytes apart. */
+#define TLSF_SL_SHIFT 4
+#define TLSF_SL     (1 << TLSF_SL_SHIFT) /* Second-level lists per level */
+#define TLSF_SMALL  (16 << TLSF_SL_SHIFT) /* Smaller blocks: first level 0 */
+/* First levels for all sizes */
+#define TLSF_FL     (8*FSIZE - 4 - TLSF_SL_SHIFT + 1)
+#define N_LISTS     (TLSF_FL * TLSF_SL + 1) /* One spare list keeps it odd */
+#else
+#define N_LISTS     N_SEGLIST
+/* The highest level of seglist is a red-black tree keyed by size and then
+address instead of a list */
+#define TREE_LEVEL  (N_SEGLIST - 1)
+#define TREE_MIN    (16 << TREE_LEVEL) /* Smallest block in the tree */
+#endif
+
+#ifdef TLSF
+#undef ADDR_ORDER /* The head of a TLSF list is taken whatever its address */
+#endif
+#ifdef ADDR_ORDER
+#define SKIP_TIERS  4 /* Tiers of the skip list over an address-ordered list */
+/* Smallest block of the levels kept in address order: HDR, SUCC, PRED,
+every tier and FTR, which is twice the minimum block and starts a level */
+#define ADDR_MIN    ((2 + SKIP_TIERS + 2)*FSIZE)
+#endif
+
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
 /* pack a size, allocated bit of current block and allocated bit of previous 
 block into a word */
 #define PACK(size, alloc, prev_alloc) ((size) | (alloc) | (prev_alloc << 1))
 
 /* Read and write a word at address p */
-#define GET(p)       (*(unsigned int *)(p))
+#define GET(p)       (*(word_t *)(p))
 
-#ifdef DEBUG
+#ifdef DEBUG_BYTES
  /*
   Debug garbled bytes problem.
   Test whether p points to memory allocated to user.
   */
  #define PUT(p, val)  { \
-  (*(unsigned int *)(p) = (val)); \
+  (*(word_t *)(p) = (val)); \
   check_access_user_memory(p, __LINE__);}
 #else
- #define PUT(p, val)  (*(unsigned int *)(p) = (val))   
+ #define PUT(p, val)  (*(word_t *)(p) = (val))
 #endif
 
 /* Read the size, allocated bit block and allocated bit of previous block from 
@@ -114,6 +325,14 @@ address p */
 #define GET_ALLOC(p) (GET(p) & 0x1)
 #define GET_PREV_ALLOC(p) ((GET(p) & 0x2) >> 1)
 
+/* Bit 2 of the header of an allocated block is set when the block is not in
+a heap but is a mapping of its own, and bit 2 of the header and footer of a
+free block is set when the pages inside it were given back by mm_trim() */
+#define MMAPPED         0x4
+#define GET_MMAPPED(p)  (GET(p) & MMAPPED)
+#define TRIMMED         0x4
+#define GET_TRIMMED(p)  (GET(p) & TRIMMED)
+
 /* Given block ptr bp, compute address of its HDR, SUCC, PRED and FTR */
 #define HDRP(bp)       ((char *)(bp) - FSIZE) 
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - 2*FSIZE) 
@@ -126,335 +345,4018 @@ address p */
 
 /* Given block ptr bp, compute the block ptr of its successor or predecessor in 
 the segregated list */
-#define SUCC_FREE_BLKP(bp)  (heap_startp + GET(SUCCP(bp)))
-#define PRED_FREE_BLKP(bp)  (heap_startp + GET(PREDP(bp)))
+#define SUCC_FREE_BLKP(a, bp)  ((a)->heap_startp + GET(SUCCP(bp)))
+#define PRED_FREE_BLKP(a, bp)  ((a)->heap_startp + GET(PREDP(bp)))
+
+/* Given block ptr bp of a free block in the tree, compute address of the 
+offsets of its children and parent, and of its color */
+#define LEFTP(bp)      ((char *)(bp))
+#define RIGHTP(bp)     ((char *)(bp) + FSIZE)
+#define PARENTP(bp)    ((char *)(bp) + 2*FSIZE)
+#define COLORP(bp)     ((char *)(bp) + 3*FSIZE)
+#define RED   1
+#define BLACK 0
+
+/* Given block ptr bp of a free block in an address-ordered list, compute 
+address of the offset of the next block in tier t of the skip list. A NULL
+bp stands for the head of the tier */
+#define SKIP_FWDP(a, level, bp, t) ((bp) == NULL ? \
+    (char *)&(a)->skip_head[level][(t) - 1] : (char *)(bp) + ((t) + 1)*FSIZE)
+
+/* Given block ptr bp and size of a free block, compute the number of fields
+after its HDR that link it into seglist, and the most any block has */
+#if defined(ADDR_ORDER)
+#define LINK_FIELDS(bp, size) \
+    ((size) >= TREE_MIN ? 4 : 2 + skip_height(bp, size))
+#define MAX_LINK_FIELDS    (2 + SKIP_TIERS)
+#elif !defined(TLSF)
+#define LINK_FIELDS(bp, size)  ((size) >= TREE_MIN ? 4 : 2)
+#define MAX_LINK_FIELDS    4
+#else
+#define LINK_FIELDS(bp, size)  2
+#define MAX_LINK_FIELDS    2
+#endif
+
+/* Given the block ptr of a mapped block, compute its mapping length and the
+start of its mapping */
+#define MMAP_LEN(bp)   (*(size_t *)((char *)(bp) - MMAP_HDR))
+#define MMAP_START(bp) ((char *)(bp) - MMAP_HDR - GET_SIZE(HDRP(bp)))
 
 /* compute the relative offset from a block pointer to start address of heap 
 which saves space than storing a real pointer in the block */
-#define HEAP_OFFSET(bp) ((char *)(bp) - heap_startp)
+#define HEAP_OFFSET(a, bp) ((char *)(bp) - (a)->heap_startp)
 
 /*
     The following block of code is used to debug "garbled bytes". It checks if 
     a pointer points to memory allocated to users, which is used to check 
     access to user memory.
-    The variables and functions are only defined in DEBUG mode.
-    Although it contains global array, it does not count in the real memory 
+    The blocks given to the user are kept in a hash table by page: a block
+    has a record in the chain of every page it covers, so that a check looks
+    at the few blocks of one page. A second table finds the first record of
+    a block by its address, and the records of a block are linked, so that
+    free() does not walk the chains of pages full of small blocks. Records
+    and tables are mapped, not allocated, and the tables double as they
+    fill.
+    The variables and functions are only defined in DEBUG_BYTES mode.
+    Although it contains global tables, it does not count in the real memory 
     allocator.
 */
-#ifdef DEBUG
-#define ARRAY_SIZE 2000
+#ifdef DEBUG_BYTES
+#define USER_MM_SHIFT  PAGE_SHIFT  /* Records are kept per page */
+#define USER_MM_CHUNK  (1 << 16)   /* Bytes of records mapped at once */
+#define USER_MM_PAGE(p) ((uintptr_t)(p) >> USER_MM_SHIFT)
+
 typedef struct user_mm {
+    uintptr_t page;             /* Page the record is for */
     char *bp;
     size_t size;
+    struct user_mm *next;       /* Next record in the chain, or free */
+    struct user_mm **pprev;     /* Link to the record in its chain */
+    struct user_mm *span;       /* Record of the next page of the block */
+    struct user_mm *bp_next;    /* Next first record in the chain of bp */
 } user_mm;
-// the global array is onle used for debugging, which will not be
+// the global tables are only used for debugging, which will not be
 // defined when actually using this memory allocator
-static user_mm user_mm_array[ARRAY_SIZE];
-static int mm_array_tail = 0;
+static user_mm **user_mm_table = NULL; /* Chains of records by page hash */
+static user_mm **user_mm_blocks = NULL; /* Chains of first records by bp */
+static size_t user_mm_bits = 0;        /* The tables have 1 << bits chains */
+static size_t user_mm_count = 0;       /* Records in the table */
+static user_mm *user_mm_free = NULL;   /* Unused records */
+#ifdef MM_THREADS
+static pthread_mutex_t user_mm_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_USER_MM()   pthread_mutex_lock(&user_mm_lock)
+# define UNLOCK_USER_MM() pthread_mutex_unlock(&user_mm_lock)
+#else
+# define LOCK_USER_MM()
+# define UNLOCK_USER_MM()
+#endif
+
+static user_mm **user_mm_chain(uintptr_t page) {
+    return &user_mm_table[(page * 0x9e3779b97f4a7c15ULL) >> 
+        (64 - user_mm_bits)];
+}
+
+static user_mm **user_mm_block(char *bp) {
+    return &user_mm_blocks[((uintptr_t)bp * 0x9e3779b97f4a7c15ULL) >> 
+        (64 - user_mm_bits)];
+}
+
+/* Put a record at the head of a chain */
+static void user_mm_link(user_mm **chain, user_mm *r) {
+    r->next = *chain;
+    if (r->next != NULL) {
+        r->next->pprev = &r->next;
+    }
+    r->pprev = chain;
+    *chain = r;
+}
+
+static void *user_mm_map(size_t bytes) {
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        printf("out of memory for user mm table\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* Double the tables, or map the first ones */
+static void user_mm_grow(void) {
+    user_mm **old = user_mm_table, **old_blocks = user_mm_blocks;
+    size_t old_size = old == NULL ? 0 : (size_t)1 << user_mm_bits;
+    size_t i;
+
+    user_mm_bits = old == NULL ? 12 : user_mm_bits + 1;
+    user_mm_table = user_mm_map(sizeof(user_mm *) << user_mm_bits);
+    user_mm_blocks = user_mm_map(sizeof(user_mm *) << user_mm_bits);
+    for (i = 0; i < old_size; i ++) {
+        while (old[i] != NULL) {
+            user_mm *r = old[i];
+            old[i] = r->next;
+            user_mm_link(user_mm_chain(r->page), r);
+        }
+        while (old_blocks[i] != NULL) {
+            user_mm *r = old_blocks[i];
+            user_mm **chain = user_mm_block(r->bp);
+            old_blocks[i] = r->bp_next;
+            r->bp_next = *chain;
+            *chain = r;
+        }
+    }
+    if (old != NULL) {
+        munmap(old, old_size * sizeof(user_mm *));
+        munmap(old_blocks, old_size * sizeof(user_mm *));
+    }
+}
+
+/* Forget every block. Called by mm_init(). */
+static void user_mm_clear(void) {
+    size_t i;
 
-/* Add the address and size of allocated memory in record array. Called when 
+    LOCK_USER_MM();
+    for (i = 0; user_mm_table != NULL && i < (size_t)1 << user_mm_bits; 
+        i ++) {
+        while (user_mm_table[i] != NULL) {
+            user_mm *r = user_mm_table[i];
+            user_mm_table[i] = r->next;
+            r->next = user_mm_free;
+            user_mm_free = r;
+        }
+        user_mm_blocks[i] = NULL;
+    }
+    user_mm_count = 0;
+    UNLOCK_USER_MM();
+}
+
+/* Add the address and size of allocated memory in record table. Called when 
 malloc() is called. */
 static void add_to_user_mm_array(char *bp, size_t size) {
-    if (mm_array_tail == ARRAY_SIZE) {
-        printf("too many blocks for array\n");
-        exit(1);
+    uintptr_t page, last = USER_MM_PAGE(bp + MAX(size, 1) - 1);
+    user_mm *prev = NULL;
+
+    LOCK_USER_MM();
+    for (page = USER_MM_PAGE(bp); page <= last; page ++) {
+        user_mm *r;
+        user_mm **chain;
+        if (user_mm_table == NULL || 
+            user_mm_count >= (size_t)2 << user_mm_bits) {
+            user_mm_grow();
+        }
+        if (user_mm_free == NULL) {
+            size_t i, n = USER_MM_CHUNK / sizeof(user_mm);
+            r = user_mm_map(USER_MM_CHUNK);
+            for (i = 0; i < n; i ++) {
+                r[i].next = user_mm_free;
+                user_mm_free = &r[i];
+            }
+        }
+        r = user_mm_free;
+        user_mm_free = r->next;
+        r->page = page;
+        r->bp = bp;
+        r->size = size;
+        r->span = NULL;
+        user_mm_link(user_mm_chain(page), r);
+        if (prev != NULL) {
+            prev->span = r;
+        } else {
+            chain = user_mm_block(bp);
+            r->bp_next = *chain;
+            *chain = r;
+        }
+        prev = r;
+        user_mm_count ++;
+    }
+    UNLOCK_USER_MM();
+}
+
+/* Remove a memory block in record table. Called when free() is called.
+Return the size it was allocated with. */
+static size_t remove_from_user_mm_array(char *bp) {
+    user_mm **pb, *r = NULL;
+    size_t size = 0;
+    int found = 0;
+
+    LOCK_USER_MM();
+    if (user_mm_table != NULL) {
+        for (pb = user_mm_block(bp); *pb != NULL && (*pb)->bp != bp; 
+            pb = &(*pb)->bp_next)
+            ;
+        r = *pb;
+    }
+    if (r != NULL) {
+        found = 1;
+        size = r->size;
+        *pb = r->bp_next;
+    }
+    while (r != NULL) {
+        user_mm *span = r->span;
+        *r->pprev = r->next;
+        if (r->next != NULL) {
+            r->next->pprev = r->pprev;
+        }
+        r->next = user_mm_free;
+        user_mm_free = r;
+        user_mm_count --;
+        r = span;
+    }
+    UNLOCK_USER_MM();
+    if (!found) {
+        printf("error free: no corresponding block in user mm array: %p\n", 
+            bp);
+    }
+    return size;
+}
+
+/* Check if a pointer points to user memory */
+static void check_access_user_memory(char *ptr, int lineno) {
+    uintptr_t page = USER_MM_PAGE(ptr);
+    user_mm *r;
+
+    LOCK_USER_MM();
+    for (r = user_mm_table == NULL ? NULL : *user_mm_chain(page); r != NULL;
+        r = r->next) {
+        if (r->page == page && ptr >= r->bp && ptr < r->bp + r->size) {
+            printf("(%d) Invalid access user allocated memory, ptr: %p\n",
+             lineno, ptr);
+        }
+    }
+    UNLOCK_USER_MM();
+}
+#endif
+
+#ifndef NO_SLAB
+/*
+ Requests of at most SLAB_MAX bytes are served by slabs instead of blocks.
+ A slab run is one page carved out of an allocated block of the heap. It 
+ starts with a slab_run_t and is followed by slots of a single size, which 
+ have no header: a bitmap in the run tells which slots are free, and the 
+ page map tells for any address whether it lies in a run and of which class.
+ */
+#define SLAB_MAX      128   /* Largest request served by a slab */
+#define SLAB_NCLASSES (SLAB_MAX / ALIGNMENT) /* Slot sizes 8, 16, ..., 128 */
+#define SLAB_RUN      (1 << PAGE_SHIFT)      /* Bytes of a run */
+#define SLAB_MAP_WORDS (SLAB_RUN / ALIGNMENT / 64)
+
+/* Class of a request of size (1 to SLAB_MAX) bytes and its slot size */
+#define SLAB_CLASS(size)     (((size) - 1) / ALIGNMENT)
+#define SLAB_SLOT_SIZE(cls)  (((cls) + 1) * ALIGNMENT)
+
+typedef struct slab_run {
+    struct slab_run *next;      /* Runs of the class with free slots */
+    struct slab_run *prev;
+    unsigned short cls;         /* Slab class of the slots */
+    unsigned short nslots;      /* Number of slots in the run */
+    unsigned short nfree;       /* Number of free slots in the run */
+    unsigned long long map[SLAB_MAP_WORDS]; /* Bit set for a free slot */
+} slab_run_t;
+
+/* Offset of the first slot in a run */
+#define SLAB_HDR      ALIGN(sizeof(slab_run_t))
+
+/* Given a slot ptr, compute the run containing it */
+#define SLAB_RUNP(p)  \
+    ((slab_run_t *)((uintptr_t)(p) & ~(uintptr_t)(SLAB_RUN - 1)))
+
+/* Page map: a 3-level radix tree over 48-bit addresses. A leaf holds one 
+byte per page, which is 0 or the slab class of the run in the page plus 1. */
+#define PM_BITS       12
+#define PM_SIZE       (1 << PM_BITS)
+#define PM_INDEX(pn, level) (((pn) >> ((level) * PM_BITS)) & (PM_SIZE - 1))
+#endif
+
+#ifndef NO_QUICK
+/*
+ A freed block smaller than QUICK_MAX_ASIZE is not coalesced at once. It 
+ stays allocated and is pushed on the quick list of its exact size, where 
+ the next request of that size takes it without splitting anything. Quick 
+ lists are swept, freeing and coalescing every block on them, when a 
+ request misses the seglist or when they hold more than QUICK_LIMIT bytes.
+ */
+#define QUICK_MAX_ASIZE (16 << 5) /* Blocks of level 0-4 seglists */
+#define QUICK_NBINS   (QUICK_MAX_ASIZE / ALIGNMENT - 2) /* One per block size */
+#ifndef QUICK_LIMIT
+#define QUICK_LIMIT   (1 << 14) /* Bytes held on quick lists before a sweep */
+#endif
+
+/* Quick list of a block size in [16, QUICK_MAX_ASIZE) */
+#define QUICK_BIN(size)  ((size) / ALIGNMENT - 2)
+
+/* The next block of a quick list is stored in the payload */
+#define QUICK_NEXT(bp)   (*(void **)(bp))
+#endif
+
+/*
+ An arena is an independent heap laid out as described above, with its own
+ seglist headers, tail sentinel, prologue and epilogue. Arena 0 grows with
+ mem_sbrk(), over whichever backend memlib was set up with. Other arenas
+ are only created by the threaded build, and each grows inside a private
+ region reserved with mmap(), so the blocks of an arena stay contiguous and
+ its 4-byte offsets stay valid.
+ */
+typedef struct arena {
+    char *heap_startp;  /* Pointer to start of heap */
+    char *heap_listp;   /* Pointer to first block */
+    char *tail;         /* End sentinel of all level of seglists */
+    word_t seg_map;     /* Bit i is set when i-level seglist is not empty */
+#ifdef TLSF
+    unsigned int sl_map[TLSF_FL]; /* Bit j of sl_map[i] is set when list 
+                                     (i, j) is not empty, and bit i of seg_map
+                                     is set when sl_map[i] is not 0 */
+#endif
+#ifdef ADDR_ORDER
+    word_t skip_head[N_SEGLIST][SKIP_TIERS]; /* Offset of the first
+                                     block in each tier of each level */
+#endif
+    char *heap_brk;     /* End of the heap */
+    char *region_lo;    /* Reserved region of the arena (not for arena 0) */
+    char *region_hi;
+    char *zero_lo;      /* Memory above has never been used, or was given
+                           back, so it is zero. For arena 0 the mark of
+                           memlib, mem_zero_lo(), NULL until it is set up */
+    char *clean_lo;     /* The heap above is zero but for the fields of free
+                           blocks and the epilogue */
+    char *verify_at;    /* Last block mm_verify_step() checked, NULL to start
+                           from the prologue */
+    char *verify_link;  /* Last free block it checked in verify_level, NULL
+                           to start from the head */
+    int verify_level;
+#ifndef NO_SLAB
+    slab_run_t *slab_partial[SLAB_NCLASSES]; /* Runs with free slots */
+#endif
+#ifndef NO_QUICK
+    void *quick[QUICK_NBINS]; /* First block of each quick list */
+    size_t quick_bytes;       /* Bytes held on quick lists */
+#endif
+#ifndef NO_STATS
+    size_t nsplit;      /* Free blocks split by an allocation */
+    size_t ncoalesce;   /* Free blocks merged by coalesce() */
+    size_t nextend;     /* Calls to extend_heap() */
+#endif
+#ifdef MM_THREADS
+    pthread_mutex_t lock;
+    int nthreads;       /* Number of threads bound to the arena */
+#endif
+} arena_t;
+
+/* The blocks inside (lo, hi) were merged into the block at lo, so the
+cursors of mm_verify_step() move off them */
+#define VERIFY_MERGED(a, lo, hi) do { \
+    if ((a)->verify_at > (char *)(lo) && (a)->verify_at < (char *)(hi)) { \
+        (a)->verify_at = (char *)(lo); \
+    } \
+    if ((a)->verify_link > (char *)(lo) && (a)->verify_link < (char *)(hi)) { \
+        (a)->verify_link = NULL; \
+    } \
+} while (0)
+
+/* Global variables */
+static unsigned int heap_gen = 0; /* Bumped every time the heap is reset */
+#ifdef DRIVER
+/* The driver only accounts for memory from mem_sbrk() */
+static size_t mmap_threshold = (size_t)-1;
+#else
+static size_t mmap_threshold = MMAP_THRESHOLD;
+#endif
+#ifndef TLSF
+static int fit_depth = FIT_DEPTH;
+#endif
+
+#ifndef NO_STATS
+/*
+ Counters of the requests of a thread. Only the thread itself writes them,
+ so counting takes neither a lock nor an atomic instruction, and mm_stats()
+ sums the counters of all threads.
+ */
+typedef struct req_stats {
+    size_t live;                     /* Usable bytes allocated less freed */
+    size_t requests[MM_STATS_SIZES]; /* Allocations per requested size */
+} req_stats_t;
+
+static size_t mapped_bytes = 0;  /* Bytes of live mappings */
+static size_t footprint = 0;     /* Bytes of heaps and mappings */
+static size_t peak_bytes = 0;    /* Most bytes footprint has reached */
+
+/* Add n to a counter that only the calling thread writes but other threads
+may read */
+# define STAT_BUMP(x, n) __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+/* Add n to a counter of an arena, under the arena lock */
+# define STAT_ADD(a, field, n) ((a)->field += (n))
+#else
+# define STAT_ADD(a, field, n)
+#endif
+
+#ifdef MM_THREADS
+#define MAX_ARENAS     16        /* Upper bound of arenas threads bind to */
+#define MAX_REGIONS    64        /* Upper bound of arenas, with the overflow */
+#define ARENAS_PER_CPU 4         /* Arenas created per online processor */
+/* Bytes reserved for arenas other than 0, which 32-bit offsets must reach */
+#ifdef WIDE_FIELDS
+#define ARENA_REGION   (1UL<<36)
+#else
+#define ARENA_REGION   (1UL<<30)
+#endif
+
+static arena_t arenas[MAX_REGIONS] = {
+    [0] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static int n_arenas = 1;
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_ARENA(a)   pthread_mutex_lock(&(a)->lock)
+# define UNLOCK_ARENA(a) pthread_mutex_unlock(&(a)->lock)
+
+/* Thread cache constants */
+#define TC_MAX_ASIZE (16 << 5) /* Cache blocks of level 0-4 seglists */
+#define TC_NBLOCK_BINS (TC_MAX_ASIZE / ALIGNMENT - 2) /* One per block size */
+#ifndef NO_SLAB
+#define TC_NBINS     (TC_NBLOCK_BINS + SLAB_NCLASSES) /* And per slab class */
+#else
+#define TC_NBINS     TC_NBLOCK_BINS
+#endif
+#define TC_CAPACITY  16   /* Blocks a magazine holds before spilling */
+#define TC_BATCH     8    /* Blocks moved per refill or spill */
+
+/* Magazine index of a block size in [16, TC_MAX_ASIZE) and of a slab class */
+#define TC_BIN(size)      ((size) / ALIGNMENT - 2)
+#define TC_SLAB_BIN(cls)  (TC_NBLOCK_BINS + (cls))
+
+/* A cached block links to the next one through its first payload bytes */
+#define TC_NEXT(bp)    (*(void **)(bp))
+
+typedef struct tcache {
+    unsigned int gen;               /* heap_gen the cached blocks belong to */
+    int registered;                 /* Whether the exit destructor is set */
+    arena_t *arena;                 /* Arena the thread is bound to */
+    unsigned char count[TC_NBINS];  /* Number of blocks in each magazine */
+    void *head[TC_NBINS];           /* First block of each magazine */
+#ifndef NO_STATS
+    req_stats_t stats;              /* Counters of the requests of the thread */
+    struct tcache *next;            /* Caches of all threads, for mm_stats() */
+    struct tcache *prev;
+#endif
+} tcache_t;
+
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+#ifndef NO_STATS
+static tcache_t *tcache_list = NULL; /* Caches of all threads, under
+                                        arenas_lock */
+static req_stats_t retired_stats;    /* Counters of threads that exited */
+#endif
+#else
+#define MAX_ARENAS 1
+
+static arena_t arenas[MAX_ARENAS];
+static const int n_arenas = 1;
+# define LOCK_ARENA(a)
+# define UNLOCK_ARENA(a)
+#ifndef NO_STATS
+static req_stats_t req_stats;
+#endif
+#endif
+
+/* What calloc() has to clear of a new block: the first bytes bytes of the
+payload, except for the pages in [skip_lo, skip_hi) that mm_trim() dropped
+from the free block it was carved from */
+typedef struct dirty {
+    size_t bytes;
+    size_t skip_lo, skip_hi;  /* Offsets in the payload, equal if none */
+} dirty_t;
+
+/* Function prototypes for internal helper routines */
+static int init_heap(arena_t *a);
+static void *malloc_block(arena_t *a, size_t asize, dirty_t *dirty);
+static void *mmap_malloc(size_t size);
+static void *mmap_aligned(size_t align, size_t size);
+static void *mmap_realloc(void *bp, size_t size, int may_move);
+static void mmap_free(void *bp);
+static int is_mmapped(void *bp);
+static size_t block_usable(void *bp);
+static size_t trim_top(arena_t *a, void *bp, size_t pad);
+static size_t trim_block(void *bp);
+static void mark_dirty(arena_t *a, void *bp);
+static void *aligned_malloc(size_t align, size_t size);
+static void *malloc_aligned_block(arena_t *a, size_t align, size_t asize);
+static void *find_fit_aligned(arena_t *a, size_t align, size_t asize);
+static void shrink_block(arena_t *a, void *bp, size_t asize);
+static void free_block(arena_t *a, void *bp);
+static void release_block(arena_t *a, void *bp);
+static size_t malloc_batch(arena_t *a, size_t asize, size_t n, void **out);
+#ifndef NO_QUICK
+static void quick_sweep(arena_t *a);
+#endif
+static int realloc_block(arena_t *a, void *bp, size_t asize);
+static void *extend_heap(arena_t *a, size_t words);
+static void place(arena_t *a, void *bp, size_t asize);
+static void *find_fit(arena_t *a, size_t asize);
+#ifndef TLSF
+static void *good_fit(arena_t *a, int level, size_t asize);
+#endif
+static void *coalesce(arena_t *a, void *bp);
+static void clean_fields(arena_t *a, void *bp);
+static void checkheap(arena_t *a, int lineno, int verbose);
+static void printblock(void *bp); 
+static void checkblock(arena_t *a, void *bp, int lineno);
+static size_t check_list(arena_t *a, int lineno, int verbose);
+static int get_level(word_t size);
+static int next_level(arena_t *a, int level);
+static char *get_root(arena_t *a, int level);
+static void list_insert(arena_t *a, void *bp, word_t size);
+static void list_remove(arena_t *a, void *bp);
+static char *level_first(arena_t *a, int level);
+static char *level_next(arena_t *a, int level, char *bp);
+#ifndef TLSF
+static void tree_insert(arena_t *a, char *bp);
+static void tree_remove(arena_t *a, char *bp);
+static char *tree_fit(arena_t *a, size_t asize);
+static char *tree_next(arena_t *a, char *bp);
+static int check_tree(arena_t *a, char *bp, int lineno);
+#endif
+#ifdef ADDR_ORDER
+static int skip_height(const void *bp, word_t size);
+static char *skip_find(arena_t *a, int level, char *bp, char **update);
+static void skip_remove(arena_t *a, int level, char *bp);
+static void check_skip(arena_t *a, int level, int lineno);
+#endif
+#ifdef MM_THREADS
+static tcache_t *tcache_get(void);
+#endif
+#ifndef NO_SLAB
+static void pagemap_clear(void);
+static void check_slabs(arena_t *a, int lineno, int verbose);
+#endif
+#ifndef NO_QUICK
+static void check_quick(arena_t *a, int lineno);
+#endif
+
+#ifndef NO_STATS
+/*
+ Count an allocation of size bytes that gave the program usable bytes
+ */
+static void stats_malloc(size_t size, size_t usable) {
+    #ifdef MM_THREADS
+    req_stats_t *s = &tcache_get()->stats;
+    #else
+    req_stats_t *s = &req_stats;
+    #endif
+    int i = MIN(63 - __builtin_clzl(size), MM_STATS_SIZES - 1);
+
+    STAT_BUMP(s->live, usable);
+    STAT_BUMP(s->requests[i], 1);
+}
+
+/*
+ Count a block resized in place from old to new usable bytes. A free is a 
+ resize to 0 bytes.
+ */
+static void stats_resize(size_t old, size_t new) {
+    #ifdef MM_THREADS
+    req_stats_t *s = &tcache_get()->stats;
+    #else
+    req_stats_t *s = &req_stats;
+    #endif
+
+    STAT_BUMP(s->live, new - old);
+}
+
+/*
+ Add delta, which wraps around to take bytes off, to the bytes of heaps and
+ mappings held, and raise the peak
+ */
+static void stats_footprint(size_t delta) {
+    size_t now = __atomic_add_fetch(&footprint, delta, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+
+    while (now > peak && !__atomic_compare_exchange_n(&peak_bytes, &peak, 
+        now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void stats_mapped(size_t delta) {
+    __atomic_add_fetch(&mapped_bytes, delta, __ATOMIC_RELAXED);
+    stats_footprint(delta);
+}
+#else
+static void stats_malloc(size_t size, size_t usable) {
+    (void)size;
+    (void)usable;
+}
+
+static void stats_resize(size_t old, size_t new) {
+    (void)old;
+    (void)new;
+}
+# define stats_footprint(delta)
+# define stats_mapped(delta)
+#endif
+
+#ifdef TRACE
+/*
+ The trace recorder. Every thread fills a chunk of records of its own, and a
+ full chunk is queued for a writer thread, which writes it to the trace file
+ and puts it back in a pool. A thread takes trace_lock only once per chunk.
+ Chunks are mapped, not allocated, and are kept until the process exits.
+ A record is numbered from trace_seq, so one atomic add per call is the only
+ store shared with other threads. A free() is numbered before the block is
+ released and an allocation after the block is taken, so the numbers order
+ the reuse of an address the way it happened.
+ */
+#define TRACE_CHUNK_SIZE (1 << 16)
+#define TRACE_CHUNK_RECS ((TRACE_CHUNK_SIZE - 2*sizeof(size_t)) / \
+                          sizeof(struct mm_trace_rec))
+
+typedef struct trace_chunk {
+    struct trace_chunk *next;           /* Next chunk in the queue or pool */
+    size_t count;                       /* Records written */
+    struct mm_trace_rec recs[TRACE_CHUNK_RECS];
+} trace_chunk_t;
+
+/* Recorder state of a thread */
+typedef struct trace_local {
+    trace_chunk_t *chunk;     /* Chunk being filled, changed under trace_lock */
+    unsigned int session;     /* trace_session the chunk belongs to */
+    int hold;                 /* Inside realloc() or calloc(), whose inner
+                                 malloc() and free() are not recorded */
+    int linked;               /* In trace_threads */
+    struct trace_local *next, *prev;
+} trace_local_t;
+
+static __thread trace_local_t trace_self;
+static int trace_on = 0;               /* Calls are recorded */
+static unsigned int trace_session = 0; /* Bumped at every start and stop */
+static int trace_fd = -1;
+static int trace_stopping = 0;         /* The writer exits once the queue is
+                                          empty */
+static pthread_t trace_writer;
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+static trace_chunk_t *trace_head = NULL; /* Queue of full chunks */
+static trace_chunk_t *trace_tail = NULL;
+static trace_chunk_t *trace_pool = NULL; /* Written chunks */
+static trace_local_t *trace_threads = NULL; /* Threads with a chunk */
+static uint64_t trace_seq = 0;         /* Number of the next record */
+
+static void trace_record(int op, void *ptr, void *old, size_t size);
+
+# define TRACE_CALL(op, ptr, old, size) do { \
+    if (__atomic_load_n(&trace_on, __ATOMIC_RELAXED)) { \
+        trace_record(op, ptr, old, size); \
+    } \
+} while (0)
+# define TRACE_HOLD(n) (trace_self.hold += (n))
+# define TRACE_ACTIVE() __atomic_load_n(&trace_on, __ATOMIC_RELAXED)
+#else
+# define TRACE_CALL(op, ptr, old, size)
+# define TRACE_HOLD(n)
+# define TRACE_ACTIVE() 0
+#endif
+
+#ifdef PROFILE
+/*
+ The heap profiler. A sampled block is kept in prof_samples, an open
+ addressing table keyed by address, and points to its call stack in
+ prof_stacks, where the samples of one stack are summed. Both tables are
+ mapped, not allocated, and changed under prof_lock. prof_filter counts the
+ live samples per hash of the address, so that free() takes the lock only
+ for a block that may be sampled.
+ */
+#define PROF_RATE        (512 * 1024) /* Default mean bytes between samples */
+#define PROF_IDLE        (1L << 26)   /* Bytes between looks at prof_rate
+                                         while the profiler is off */
+#define PROF_DEPTH       32           /* Frames kept of a call stack */
+#define PROF_SAMPLE_BITS 17           /* prof_samples has 1 << 17 slots, and
+                                         keeps at most half as many */
+#define PROF_STACK_BITS  14           /* prof_stacks likewise, 3/4 used */
+#define PROF_FILTER_BITS 16
+#define PROF_SIGNAL      SIGUSR2      /* Dumps a profile when MM_PROFILE is
+                                         set */
+#define PROF_HASH(x, bits) \
+    (size_t)((uint64_t)(x) * 0x9e3779b97f4a7c15ULL >> (64 - (bits)))
+#define PROF_PTR_HASH(p, bits) PROF_HASH((uintptr_t)(p) >> 3, bits)
+
+typedef struct prof_stack {
+    uint64_t hash;                /* 0 if the slot is empty */
+    int depth;
+    void *pcs[PROF_DEPTH];
+    size_t live_count;            /* Samples not freed yet */
+    size_t live_bytes;
+    size_t alloc_count;           /* All samples since the start */
+    size_t alloc_bytes;
+} prof_stack_t;
+
+typedef struct prof_sample {
+    void *ptr;                    /* NULL if the slot is empty */
+    size_t size;                  /* Bytes asked for */
+    prof_stack_t *stack;
+} prof_sample_t;
+
+static size_t prof_rate = 0;                  /* 0 if off */
+static size_t prof_live = 0;                  /* Samples in prof_samples */
+static size_t prof_nstacks = 0;               /* Stacks in prof_stacks */
+static prof_sample_t *prof_samples = NULL;
+static prof_stack_t *prof_stacks = NULL;
+static unsigned char prof_filter[1 << PROF_FILTER_BITS];
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread long prof_countdown = 0;      /* Bytes to the next sample */
+static __thread uint64_t prof_rnd = 0;        /* 0 until the first call */
+static __thread int prof_busy = 0;            /* Taking a sample */
+
+static void prof_sample(void *bp, size_t size);
+static void prof_forget(void *bp);
+
+# define PROF_MALLOC(bp, size) do { \
+    if ((prof_countdown -= (long)(size)) < 0) { \
+        prof_sample(bp, size); \
+    } \
+} while (0)
+# define PROF_FREE(bp) do { \
+    if (__atomic_load_n(&prof_filter[PROF_PTR_HASH(bp, PROF_FILTER_BITS)], \
+        __ATOMIC_RELAXED) != 0) { \
+        prof_forget(bp); \
+    } \
+} while (0)
+#else
+# define PROF_MALLOC(bp, size)
+# define PROF_FREE(bp)
+#endif
+
+/*
+ Initialize the heap. mm_init() is also how the driver resets the heap
+ between traces: arena 0 is laid out again, the other arenas are emptied
+ and laid out on their next use, and heap_gen is bumped which invalidates
+ every thread cache.
+ */
+int mm_init(void) {
+    int rt = 0;
+    int i;
+
+    /* debug garbled bytes */
+    #ifdef DEBUG_BYTES
+    user_mm_clear();
+    #endif
+
+    #ifndef NO_STATS
+    /* Mappings outlive the heap. The counters of threads are cleared when
+    they next see heap_gen. */
+    footprint = mapped_bytes;
+    peak_bytes = footprint;
+    #ifdef MM_THREADS
+    memset(&retired_stats, 0, sizeof(retired_stats));
+    #else
+    memset(&req_stats, 0, sizeof(req_stats));
+    #endif
+    #endif
+
+    for (i = 0; i < n_arenas; i ++) {
+        arena_t *a = &arenas[i];
+        LOCK_ARENA(a);
+        #ifndef NO_SLAB
+        memset(a->slab_partial, 0, sizeof(a->slab_partial));
+        #endif
+        #ifndef NO_QUICK
+        memset(a->quick, 0, sizeof(a->quick));
+        a->quick_bytes = 0;
+        #endif
+        #ifndef NO_STATS
+        a->nsplit = a->ncoalesce = a->nextend = 0;
+        #endif
+        a->verify_at = a->verify_link = NULL;
+        if (i == 0) {
+            /* With sim, the memory of earlier heaps is not zero */
+            a->zero_lo = mem_zero_lo();
+            rt = init_heap(a);
+        } else {
+            a->heap_listp = 0;
+            a->heap_brk = a->region_lo;
+        }
+        UNLOCK_ARENA(a);
+    }
+    #ifndef NO_SLAB
+    pagemap_clear();
+    #endif
+    heap_gen ++;
+    return rt;
+}
+
+/*
+ Grow the heap of an arena by incr bytes and return the old end of the heap,
+ or (void *)-1 when the arena is out of memory.
+ */
+static void *arena_sbrk(arena_t *a, size_t incr) {
+    char *old = a->heap_brk;
+
+    if (a->region_lo == 0) {
+        /* Arena 0, which mem_sbrk() grows by at most INT_MAX bytes */
+        if (incr > INT_MAX || (old = mem_sbrk(incr)) == (void *)-1) {
+            return (void *)-1;
+        }
+        a->zero_lo = mem_zero_lo();
+    } else if (incr > (size_t)(a->region_hi - old)) {
+        return (void *)-1;
+    }
+    a->heap_brk = old + incr;
+    if (a->zero_lo != NULL && a->heap_brk > a->zero_lo) {
+        a->zero_lo = a->heap_brk;
+    }
+    stats_footprint(incr);
+    return old;
+}
+
+/*
+ Lower the end of the heap of an arena to end. Arena 0 lowers the break of
+ memlib with it, and an arena in a region of its own drops the pages above
+ end, which are zero again. Return the bytes of whole pages given back.
+ */
+static size_t arena_shrink(arena_t *a, char *end) {
+    size_t decr = a->heap_brk - end;
+    char *lo = (char *)PAGE_UP(end);
+    char *hi;
+
+    stats_footprint(-decr);
+    if (a->region_lo == 0) {
+        /* Arena 0, whose break mem_sbrk() moves by at most INT_MAX bytes */
+        hi = (char *)PAGE_UP(a->heap_brk);
+        while (decr > 0) {
+            int n = (int)MIN(decr, (size_t)INT_MAX);
+            mem_sbrk(-n);
+            decr -= n;
+        }
+        a->heap_brk = end;
+        a->zero_lo = mem_zero_lo();
+        return hi - lo;
+    }
+    a->heap_brk = end;
+    hi = (char *)PAGE_UP(a->zero_lo);
+    if (lo >= hi) {
+        return 0;
+    }
+    madvise(lo, hi - lo, MADV_DONTNEED);
+    a->zero_lo = lo;
+    return hi - lo;
+}
+
+/*
+ Get the arena that owns the block pointed by bp.
+ */
+static arena_t *arena_of(const void *bp) {
+    #ifdef MM_THREADS
+    int i, n = __atomic_load_n(&n_arenas, __ATOMIC_ACQUIRE);
+    for (i = 1; i < n; i ++) {
+        if ((char *)bp >= arenas[i].region_lo && 
+            (char *)bp < arenas[i].region_hi) {
+            return &arenas[i];
+        }
+    }
+    #else
+    (void)bp;
+    #endif
+    return &arenas[0];
+}
+
+#ifdef MM_THREADS
+/*
+ Reserve the region of a new arena. Called with arenas_lock held. Return 
+ NULL when the limit of arenas is reached or the region cannot be mapped.
+ An overflow arena, which takes the requests every other arena is too full
+ for, may go past the limit up to MAX_REGIONS.
+ */
+static arena_t *arena_create(int overflow) {
+    static int limit = 0;
+    arena_t *a;
+    char *region;
+
+    if (limit == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        limit = ncpu > 0 ? ncpu * ARENAS_PER_CPU : ARENAS_PER_CPU;
+        limit = limit > MAX_ARENAS ? MAX_ARENAS : limit;
+    }
+    if (n_arenas >= (overflow ? MAX_REGIONS : limit)) {
+        return NULL;
+    }
+    region = mmap(NULL, ARENA_REGION, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+    a = &arenas[n_arenas];
+    pthread_mutex_init(&a->lock, NULL);
+    a->heap_listp = 0;
+    a->heap_brk = region;
+    a->region_lo = region;
+    a->region_hi = region + ARENA_REGION;
+    a->zero_lo = region;
+    a->nthreads = 0;
+    /* Publish the arena only after it is set up for arena_of() */
+    __atomic_store_n(&n_arenas, n_arenas + 1, __ATOMIC_RELEASE);
+    return a;
+}
+
+/*
+ Bind the calling thread to the least contended arena, which is the arena 
+ with the fewest bound threads. A new arena is created instead while every
+ arena has threads and the limit is not reached, but only for a thread that
+ will move to it. A bound thread only moves when the other arena is strictly
+ less loaded than its own, so a thread alone in its arena stays.
+ */
+static arena_t *arena_bind(tcache_t *tc) {
+    arena_t *cur = tc->arena;
+    arena_t *best = NULL;
+    int i;
+
+    pthread_mutex_lock(&arenas_lock);
+    for (i = 0; i < n_arenas; i ++) {
+        if (&arenas[i] != cur && 
+            (best == NULL || arenas[i].nthreads < best->nthreads)) {
+            best = &arenas[i];
+        }
+    }
+    if ((best == NULL || best->nthreads > 0) &&
+        (cur == NULL || cur->nthreads > 1)) {
+        arena_t *a = arena_create(0);
+        if (a != NULL) {
+            best = a;
+        }
+    }
+    if (best != NULL && 
+        (cur == NULL || best->nthreads < cur->nthreads - 1)) {
+        if (cur != NULL) {
+            cur->nthreads --;
+        }
+        best->nthreads ++;
+        tc->arena = best;
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    return tc->arena;
+}
+
+/*
+ Get an arena to spill a request into once the arena of the thread and
+ arena 0 are out of memory: the newest arena, or with fresh set a new
+ overflow arena. Return NULL when there is none.
+ */
+static arena_t *arena_overflow(int fresh) {
+    arena_t *a = NULL;
+
+    pthread_mutex_lock(&arenas_lock);
+    if (fresh) {
+        a = arena_create(1);
+    } else if (n_arenas > 1) {
+        a = &arenas[n_arenas - 1];
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    return a;
+}
+#endif
+
+/*
+ Lock and return the arena the calling thread allocates from. A thread that
+ finds its arena busy is moved to a less contended one.
+ */
+static arena_t *arena_get(void) {
+    #ifdef MM_THREADS
+    tcache_t *tc = tcache_get();
+    arena_t *a = tc->arena;
+
+    if (a == NULL) {
+        a = arena_bind(tc);
+    }
+    if (pthread_mutex_trylock(&a->lock) == 0) {
+        return a;
+    }
+    a = arena_bind(tc);
+    LOCK_ARENA(a);
+    return a;
+    #else
+    return &arenas[0];
+    #endif
+}
+
+/*
+ Allocate a block of asize bytes from the arena of the calling thread. When
+ that arena is out of memory, arena 0 is tried instead, and then the newest
+ arena and a new overflow arena. Called without any arena lock held. See
+ malloc_block() for dirty.
+ */
+static void *arena_malloc(size_t asize, dirty_t *dirty) {
+    arena_t *a = arena_get();
+    void *bp = malloc_block(a, asize, dirty);
+
+    UNLOCK_ARENA(a);
+    if (bp == NULL && a != &arenas[0]) {
+        a = &arenas[0];
+        LOCK_ARENA(a);
+        bp = malloc_block(a, asize, dirty);
+        UNLOCK_ARENA(a);
+    }
+    #ifdef MM_THREADS
+    int fresh;
+    /* A block over half a region is left to fail rather than reserve
+    regions it never fits in */
+    for (fresh = 0; bp == NULL && fresh < 2 && asize <= ARENA_REGION/2;
+        fresh ++) {
+        if ((a = arena_overflow(fresh)) != NULL) {
+            LOCK_ARENA(a);
+            bp = malloc_block(a, asize, dirty);
+            UNLOCK_ARENA(a);
+        }
+    }
+    #endif
+    return bp;
+}
+
+#ifndef NO_SLAB
+static void *pagemap[PM_SIZE]; /* Root of the page map */
+
+/*
+ Get the page map byte of the page containing p. Readers take no lock: a 
+ node is never freed and is published only after it is zeroed.
+ */
+static int pagemap_get(const void *p) {
+    uintptr_t pn = (uintptr_t)p >> PAGE_SHIFT;
+    void **mid;
+    unsigned char *leaf;
+
+    mid = __atomic_load_n(&pagemap[PM_INDEX(pn, 2)], __ATOMIC_ACQUIRE);
+    if (mid == NULL) {
+        return 0;
+    }
+    leaf = __atomic_load_n(&mid[PM_INDEX(pn, 1)], __ATOMIC_ACQUIRE);
+    if (leaf == NULL) {
+        return 0;
+    }
+    return leaf[PM_INDEX(pn, 0)];
+}
+
+/*
+ Get the page map node stored at slot, mapping a zeroed one of bytes bytes 
+ if there is none yet. Two threads may race to fill the same slot, so the 
+ node is installed with a compare-and-swap and the loser unmaps its own.
+ */
+static void *pagemap_node(void **slot, size_t bytes) {
+    void *node = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    void *expected = NULL;
+
+    if (node != NULL) {
+        return node;
+    }
+    node = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (node == MAP_FAILED) {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(slot, &expected, node, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(node, bytes);
+        node = expected;
+    }
+    return node;
+}
+
+/*
+ Set the page map byte of the page containing p. Return -1 when a node of 
+ the page map cannot be mapped.
+ */
+static int pagemap_set(const void *p, int val) {
+    uintptr_t pn = (uintptr_t)p >> PAGE_SHIFT;
+    void **mid;
+    unsigned char *leaf;
+
+    mid = pagemap_node(&pagemap[PM_INDEX(pn, 2)], PM_SIZE * sizeof(void *));
+    if (mid == NULL) {
+        return -1;
+    }
+    leaf = pagemap_node(&mid[PM_INDEX(pn, 1)], PM_SIZE);
+    if (leaf == NULL) {
+        return -1;
+    }
+    leaf[PM_INDEX(pn, 0)] = val;
+    return 0;
+}
+
+/*
+ Forget every run in the page map. Called by mm_init() when the heap the 
+ runs were carved from is thrown away.
+ */
+static void pagemap_clear(void) {
+    int i, j;
+
+    for (i = 0; i < PM_SIZE; i ++) {
+        void **mid = pagemap[i];
+        if (mid == NULL) {
+            continue;
+        }
+        for (j = 0; j < PM_SIZE; j ++) {
+            if (mid[j] != NULL) {
+                memset(mid[j], 0, PM_SIZE);
+            }
+        }
+    }
+}
+
+/*
+ Remove a run from the partial runs of its class.
+ */
+static void slab_unlink(arena_t *a, slab_run_t *run) {
+    if (run->prev != NULL) {
+        run->prev->next = run->next;
+    } else {
+        a->slab_partial[run->cls] = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
+    }
+}
+
+/*
+ Carve a new run of class cls out of the heap of an arena and make it the 
+ first partial run of the class. The run is the payload of an allocated 
+ block of SLAB_RUN bytes whose block ptr is page aligned: its header is the
+ last field of the previous page and the header of the next block is the 
+ last field of the run, so runs carved one after another pack tightly.
+ Called with the arena lock held.
+ */
+static slab_run_t *slab_new_run(arena_t *a, int cls) {
+    slab_run_t *run;
+    int i;
+
+    run = malloc_aligned_block(a, SLAB_RUN, SLAB_RUN);
+    if (run == NULL) {
+        return NULL;
+    }
+    if (pagemap_set(run, cls + 1) < 0) {
+        free_block(a, run);
+        return NULL;
+    }
+    run->cls = cls;
+    run->nslots = (SLAB_RUN - FSIZE - SLAB_HDR) / SLAB_SLOT_SIZE(cls);
+    run->nfree = run->nslots;
+    memset(run->map, 0, sizeof(run->map));
+    for (i = 0; i < run->nslots / 64; i ++) {
+        run->map[i] = ~0ULL;
+    }
+    if (run->nslots % 64) {
+        run->map[i] = (1ULL << (run->nslots % 64)) - 1;
+    }
+    run->prev = NULL;
+    run->next = a->slab_partial[cls];
+    if (run->next != NULL) {
+        run->next->prev = run;
+    }
+    a->slab_partial[cls] = run;
+    return run;
+}
+
+/*
+ Allocate a slot of class cls from an arena. Return NULL when no run can be
+ carved. Called with the arena lock held.
+ */
+static void *slab_malloc(arena_t *a, int cls) {
+    slab_run_t *run = a->slab_partial[cls];
+    int i, bit;
+
+    if (run == NULL && (run = slab_new_run(a, cls)) == NULL) {
+        return NULL;
+    }
+    /* A partial run has at least one bit set */
+    for (i = 0; run->map[i] == 0; i ++) {
+    }
+    bit = __builtin_ctzll(run->map[i]);
+    run->map[i] &= run->map[i] - 1;
+    if (-- run->nfree == 0) {
+        slab_unlink(a, run);
+    }
+    return (char *)run + SLAB_HDR + (i * 64 + bit) * SLAB_SLOT_SIZE(cls);
+}
+
+/*
+ Give the slot pointed by p back to its run. A run that becomes empty is 
+ returned to the heap unless it is the last partial run of its class, which
+ is kept to avoid carving a new run for the next malloc. Called with the 
+ lock of the arena owning the run held.
+ */
+static void slab_free(arena_t *a, void *p) {
+    slab_run_t *run = SLAB_RUNP(p);
+    size_t idx = ((char *)p - (char *)run - SLAB_HDR) /
+        SLAB_SLOT_SIZE(run->cls);
+
+    run->map[idx / 64] |= 1ULL << (idx % 64);
+    if (run->nfree ++ == 0) {
+        /* The run was full */
+        run->prev = NULL;
+        run->next = a->slab_partial[run->cls];
+        if (run->next != NULL) {
+            run->next->prev = run;
+        }
+        a->slab_partial[run->cls] = run;
+    } else if (run->nfree == run->nslots && 
+        (run->prev != NULL || run->next != NULL)) {
+        slab_unlink(a, run);
+        pagemap_set(run, 0);
+        free_block(a, run);
+    }
+}
+#endif
+
+/*
+ Return the number of payload bytes of the block or slot pointed by bp. An
+ allocated block has no footer, so all of it but the header is payload.
+ */
+static size_t usable_size(void *bp) {
+    #ifndef NO_SLAB
+    int cls = pagemap_get(bp);
+    if (cls > 0) {
+        return SLAB_SLOT_SIZE(cls - 1);
+    }
+    #endif
+    return block_usable(bp);
+}
+
+/*
+ Return the number of payload bytes of the normal or mapped block pointed by
+ bp, which is known not to be a slot
+ */
+static size_t block_usable(void *bp) {
+    if (GET_MMAPPED(HDRP(bp))) {
+        return MMAP_LEN(bp) - MMAP_HDR - GET_SIZE(HDRP(bp));
+    }
+    return GET_SIZE(HDRP(bp)) - FSIZE;
+}
+
+/*
+ Set the size of the smallest request that is served by a mapping of its 
+ own instead of a heap. Smaller values than a page are raised to a page. 
+ Return the previous threshold.
+ */
+size_t mm_set_mmap_threshold(size_t bytes) {
+    size_t old = mmap_threshold;
+
+    mmap_threshold = MAX(bytes, PAGE_SIZE);
+    return old;
+}
+
+/*
+ Map a block of size bytes. The mapping starts with its length, and the 
+ header in front of the payload only carries the MMAPPED bit, so that 
+ free() can tell the block apart from heap blocks.
+ */
+static void *mmap_malloc(size_t size) {
+    size_t len = PAGE_UP(size + MMAP_HDR);
+    char *m, *bp;
+
+    if (len < size) {
+        return NULL; /* Wrapped around */
+    }
+    m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    bp = m + MMAP_HDR;
+    MMAP_LEN(bp) = len;
+    PUT(HDRP(bp), PACK(0, 1, 1) | MMAPPED);
+    stats_mapped(len);
+    return bp;
+}
+
+/*
+ Map a block of size bytes at a multiple of align. The mapping is made align
+ bytes larger, and the whole pages in front of the block and behind it are
+ unmapped again.
+ */
+static void *mmap_aligned(size_t align, size_t size) {
+    size_t over = size + MMAP_HDR + align, len;
+    char *m, *bp, *start, *end;
+
+    if (over < size) {
+        return NULL; /* Wrapped around */
+    }
+    over = PAGE_UP(over);
+    m = mmap(NULL, over, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    bp = (char *)(((uintptr_t)m + MMAP_HDR + align - 1) & ~(align - 1));
+    start = (char *)PAGE_DOWN(bp - MMAP_HDR);
+    end = (char *)PAGE_UP(bp + size);
+    if (start > m) {
+        munmap(m, start - m);
+    }
+    if (end < m + over) {
+        munmap(end, m + over - end);
+    }
+    len = end - start;
+    MMAP_LEN(bp) = len;
+    PUT(HDRP(bp), PACK(bp - MMAP_HDR - start, 1, 1) | MMAPPED);
+    stats_mapped(len);
+    return bp;
+}
+
+/*
+ Resize the mapping of the block pointed by bp to hold size bytes. The 
+ kernel moves the pages instead of copying them, unless may_move is 0 and
+ the mapping must stay where it is. Return NULL on failure, when the block
+ is left untouched.
+ */
+static void *mmap_realloc(void *bp, size_t size, int may_move) {
+    size_t pad = GET_SIZE(HDRP(bp));
+    size_t len = PAGE_UP(size + MMAP_HDR + pad);
+    char *m;
+
+    if (len < size) {
+        return NULL;
+    }
+    m = mremap(MMAP_START(bp), MMAP_LEN(bp), len,
+        may_move ? MREMAP_MAYMOVE : 0);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    bp = m + pad + MMAP_HDR;
+    stats_mapped(len - MMAP_LEN(bp));
+    MMAP_LEN(bp) = len;
+    return bp;
+}
+
+/*
+ Unmap the block pointed by bp
+ */
+static void mmap_free(void *bp) {
+    stats_mapped(-MMAP_LEN(bp));
+    munmap(MMAP_START(bp), MMAP_LEN(bp));
+}
+
+/*
+ Return whether the pointer is a block of its own mapping
+ */
+static int is_mmapped(void *bp) {
+    #ifndef NO_SLAB
+    if (pagemap_get(bp) > 0) {
+        return 0; /* A slot has no header */
+    }
+    #endif
+    return GET_MMAPPED(HDRP(bp)) != 0;
+}
+
+/*
+ Initialize global variables and the heap including prologue block, 
+ epilogue block, header of each level of seglist and tail of all levels 
+ of seglist.
+ Request the first free block.
+ */
+static int init_heap(arena_t *a) {
+    dbg_printf("INIT\n");
+
+    /* Create the initial empty heap */
+    if ((a->heap_startp = arena_sbrk(a, (N_LISTS + 5)*FSIZE)) == (void *)-1) 
+        return -1;
+
+    PUT(a->heap_startp, 0); /* Address of tail and the SUCC field of tail */
+    PUT(a->heap_startp + (1*FSIZE), 0); /*PRED field of tail*/
+    a->tail = a->heap_startp;
+    a->seg_map = 0;
+    a->clean_lo = a->heap_brk;
+#ifdef TLSF
+    memset(a->sl_map, 0, sizeof(a->sl_map));
+#endif
+#ifdef ADDR_ORDER
+    memset(a->skip_head, 0, sizeof(a->skip_head));
+#endif
+
+    int i = 2;
+    for (i = 2; i < N_LISTS + 2; i ++) { /* header of each level of seglist */
+        // Initialize each seg_header and let them point to tail
+        PUT(a->heap_startp + (i*FSIZE), HEAP_OFFSET(a, a->tail)); 
+    }
+
+    PUT(a->heap_startp + ((N_LISTS + 2)*FSIZE),
+     PACK(2*FSIZE, 1, 1)); /* Prologue block header */
+    PUT(a->heap_startp + ((N_LISTS + 3)*FSIZE),
+     PACK(2*FSIZE, 1, 1)); /* Prologue block footer */
+    PUT(a->heap_startp + ((N_LISTS + 4)*FSIZE),
+     PACK(0, 1, 1)); /* Epilogue block header */
+    a->heap_listp = a->heap_startp + (N_LISTS + 3)*FSIZE;
+    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
+    if (extend_heap(a, CHUNKSIZE/FSIZE) == NULL){ 
+        return -1;
+    }
+
+    dbg_checkheap(a, __LINE__, 0);
+    dbg_printf("END INIT\n");
+    
+    return 0;
+}
+
+/*
+ Adjust a request of size bytes to the size of the block that holds it,
+ including overhead and alignment reqs.
+ */
+static size_t adjust_size(size_t size) {
+    if (size <= 2*FSIZE){
+        return 4*FSIZE;
+    }
+    if (size > MAX_BLOCK - FSIZE) {
+        return (size_t)-1; /* No header can hold it */
+    }
+    /* The payload and HDR rounded up to keep the next payload aligned */
+    return ALIGN(size + FSIZE);
+}
+
+#ifdef MM_THREADS
+/*
+ Take one block or slot for magazine i out of an arena. Called with the 
+ arena lock held.
+ */
+static void *tcache_take(arena_t *a, int i) {
+    #ifndef NO_SLAB
+    if (i >= TC_NBLOCK_BINS) {
+        return slab_malloc(a, i - TC_NBLOCK_BINS);
+    }
+    #endif
+    return malloc_block(a, (i + 2) * ALIGNMENT, NULL);
+}
+
+/*
+ Give one block or slot of magazine i back to the arena owning it. Called 
+ with the arena lock held.
+ */
+static void tcache_release(arena_t *a, int i, void *bp) {
+    #ifndef NO_SLAB
+    if (i >= TC_NBLOCK_BINS) {
+        slab_free(a, bp);
+        return;
+    }
+    #else
+    (void)i;
+    #endif
+    release_block(a, bp);
+}
+
+/*
+ Return n cached blocks of a magazine to the arenas that own them. Blocks of
+ the same arena in a row are freed under one lock. Called without any arena
+ lock held.
+ */
+static void tcache_drain(tcache_t *tc, int i, int n) {
+    arena_t *locked = NULL;
+
+    while (n > 0 && tc->count[i] > 0) {
+        void *bp = tc->head[i];
+        arena_t *a = arena_of(bp);
+
+        tc->head[i] = TC_NEXT(bp);
+        tc->count[i] --;
+        if (a != locked) {
+            if (locked != NULL) {
+                UNLOCK_ARENA(locked);
+            }
+            LOCK_ARENA(a);
+            locked = a;
+        }
+        tcache_release(a, i, bp);
+        n --;
+    }
+    if (locked != NULL) {
+        UNLOCK_ARENA(locked);
+    }
+}
+
+/*
+ Destructor of tcache_key. A thread that exits gives its cached blocks back
+ to the heap, otherwise they would be lost to everyone, and leaves its arena.
+ */
+static void tcache_destroy(void *arg) {
+    tcache_t *tc = arg;
+    int i;
+
+    if (tc->gen == heap_gen) {
+        for (i = 0; i < TC_NBINS; i ++) {
+            tcache_drain(tc, i, TC_CAPACITY);
+        }
+    }
+    pthread_mutex_lock(&arenas_lock);
+    if (tc->arena != NULL) {
+        tc->arena->nthreads --;
+    }
+    #ifndef NO_STATS
+    /* Keep the counters of the thread for mm_stats() */
+    if (tc->gen == heap_gen) {
+        retired_stats.live += tc->stats.live;
+        for (i = 0; i < MM_STATS_SIZES; i ++) {
+            retired_stats.requests[i] += tc->stats.requests[i];
+        }
+    }
+    if (tc->prev != NULL) {
+        tc->prev->next = tc->next;
+    } else {
+        tcache_list = tc->next;
+    }
+    if (tc->next != NULL) {
+        tc->next->prev = tc->prev;
+    }
+    #endif
+    pthread_mutex_unlock(&arenas_lock);
+    memset(tc, 0, sizeof(tcache_t));
+}
+
+static void tcache_key_init(void) {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/*
+ Get the thread cache of the calling thread. The cache is emptied when the
+ heap has been reset since the blocks were cached.
+ */
+static tcache_t *tcache_get(void) {
+    tcache_t *tc = &tcache;
+
+    if (!tc->registered) {
+        pthread_once(&tcache_once, tcache_key_init);
+        pthread_setspecific(tcache_key, tc);
+        tc->registered = 1;
+        #ifndef NO_STATS
+        pthread_mutex_lock(&arenas_lock);
+        tc->next = tcache_list;
+        if (tcache_list != NULL) {
+            tcache_list->prev = tc;
+        }
+        tcache_list = tc;
+        pthread_mutex_unlock(&arenas_lock);
+        #endif
+    }
+    if (tc->gen != heap_gen) {
+        memset(tc->count, 0, sizeof(tc->count));
+        memset(tc->head, 0, sizeof(tc->head));
+        #ifndef NO_STATS
+        memset(&tc->stats, 0, sizeof(tc->stats));
+        #endif
+        tc->gen = heap_gen;
+    }
+    return tc;
+}
+
+/*
+ Allocate a block or slot from magazine i of the thread cache. An empty 
+ magazine is refilled with TC_BATCH blocks from the arena of the thread 
+ under one lock. Return NULL when the arena is out of memory.
+ */
+static void *tcache_malloc(int i) {
+    tcache_t *tc = tcache_get();
+    void *bp;
+
+    if (tc->count[i] == 0) {
+        arena_t *a = arena_get();
+        while (tc->count[i] < TC_BATCH) {
+            if ((bp = tcache_take(a, i)) == NULL) {
+                break;
+            }
+            /* place() may hand out a bigger block when the remainder is
+            too small to split. Such a block belongs to another magazine. */
+            if (i < TC_NBLOCK_BINS && 
+                GET_SIZE(HDRP(bp)) != (word_t)(i + 2) * ALIGNMENT) {
+                if (tc->count[i] > 0) {
+                    free_block(a, bp);
+                    break;
+                }
+                UNLOCK_ARENA(a);
+                return bp;
+            }
+            TC_NEXT(bp) = tc->head[i];
+            tc->head[i] = bp;
+            tc->count[i] ++;
+        }
+        UNLOCK_ARENA(a);
+        if (tc->count[i] == 0) {
+            return NULL;
+        }
+    }
+    bp = tc->head[i];
+    tc->head[i] = TC_NEXT(bp);
+    tc->count[i] --;
+    return bp;
+}
+
+/*
+ Put a block or slot into magazine i of the thread cache. A full magazine 
+ spills TC_BATCH blocks to their arenas.
+ */
+static void tcache_free(void *bp, int i) {
+    tcache_t *tc = tcache_get();
+
+    if (tc->count[i] == TC_CAPACITY) {
+        tcache_drain(tc, i, TC_BATCH);
+    }
+    TC_NEXT(bp) = tc->head[i];
+    tc->head[i] = bp;
+    tc->count[i] ++;
+}
+#endif
+
+/*
+ Allocate memory to user according to size. First get the real size of 
+ allocation by calculating aszie (adjusted block size). Small requests are
+ served by a slab slot, and by a normal block when no run can be carved.
+ */
+void *malloc (size_t size) {
+    dbg_printf("MALLOC (size: %ld)\n", size);
+
+    size_t asize;      /* Adjusted block size */
+    size_t usable = 0; /* Usable bytes if bp is a slot, which has no header */
+    char *bp = NULL;
+
+    /* Ignore spurious requests */
+    if (size == 0){
+        dbg_printf("END MALLOC (size == 0)\n");
+        return NULL;
+    }
+
+    asize = adjust_size(size);
+
+    if (size >= mmap_threshold || asize > MAX_BLOCK) {
+        /* A block too large for a header can only be a mapping */
+        bp = mmap_malloc(size);
+    }
+    #ifndef NO_SLAB
+    else if (size <= SLAB_MAX) {
+        #ifdef MM_THREADS
+        bp = tcache_malloc(TC_SLAB_BIN(SLAB_CLASS(size)));
+        #else
+        arena_t *a = arena_get();
+        bp = slab_malloc(a, SLAB_CLASS(size));
+        UNLOCK_ARENA(a);
+        #endif
+        if (bp != NULL) {
+            usable = SLAB_SLOT_SIZE(SLAB_CLASS(size));
+        }
+    }
+    #endif
+    #ifdef MM_THREADS
+    else if (asize < TC_MAX_ASIZE) {
+        bp = tcache_malloc(TC_BIN(asize));
+    }
+    #endif
+    if (bp == NULL) {
+        bp = arena_malloc(asize, NULL);
+    }
+    if (bp != NULL) {
+        stats_malloc(size, usable > 0 ? usable : block_usable(bp));
+        TRACE_CALL(MM_TRACE_MALLOC, bp, NULL, size);
+        PROF_MALLOC(bp, size);
+    }
+
+    /* debug garbled bytes */
+    #ifdef DEBUG_BYTES
+    if (bp != NULL) {
+        add_to_user_mm_array(bp, size);
+    }
+    #endif
+    return bp;
+}
+
+/*
+ Fill in what calloc() has to clear of the block pointed by bp, before it is
+ taken: the payload below the clean part of the heap, but for the whole
+ pages inside a free block marked TRIMMED. Any rewrite of its header, as
+ when it is split or merged, clears the mark.
+ */
+static void get_dirty(arena_t *a, char *bp, dirty_t *dirty) {
+    dirty->bytes = MAX(a->clean_lo, bp) - bp;
+    dirty->skip_lo = dirty->skip_hi = 0;
+    if (!GET_ALLOC(HDRP(bp)) && GET_TRIMMED(HDRP(bp))) {
+        char *fields = bp + LINK_FIELDS(bp, GET_SIZE(HDRP(bp)))*FSIZE;
+        dirty->skip_lo = PAGE_UP(fields) - (uintptr_t)bp;
+        dirty->skip_hi = PAGE_DOWN(FTRP(bp)) - (uintptr_t)bp;
+    }
+}
+
+/*
+ Take a block of asize bytes out of an arena, extending the heap of the
+ arena when its seglist has no fit. Called with the arena lock held.
+ If dirty is not NULL, it is set to the bytes of the payload that may be
+ non-zero. Apart from them only the first 4 and the last fields of the
+ payload, left from the free block, may be non-zero.
+ */
+static void *malloc_block(arena_t *a, size_t asize, dirty_t *dirty) {
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;
+
+    if (asize > MAX_BLOCK) {
+        return NULL;
+    }
+    if (a->heap_listp == 0){
+        if (init_heap(a) < 0) {
+            return NULL;
+        }
+    }
+
+    #ifndef NO_QUICK
+    /* Take a block of the exact size off its quick list */
+    if (asize < QUICK_MAX_ASIZE && (bp = a->quick[QUICK_BIN(asize)]) != NULL) {
+        a->quick[QUICK_BIN(asize)] = QUICK_NEXT(bp);
+        a->quick_bytes -= asize;
+        if (dirty != NULL) {
+            get_dirty(a, bp, dirty);
+        }
+        return bp;
+    }
+    #endif
+
+    /* Search the seglist list for a fit */
+    bp = find_fit(a, asize);
+    #ifndef NO_QUICK
+    if (bp == NULL && a->quick_bytes > 0) {
+        /* Coalescing the quick lists may make a fit */
+        quick_sweep(a);
+        bp = find_fit(a, asize);
+    }
+    #endif
+    if (bp != NULL) {
+        if (dirty != NULL) {
+            get_dirty(a, bp, dirty);
+        }
+        place(a, bp, asize);
+        dbg_checkheap(a, __LINE__, 0);
+        dbg_printf("END MALLOC (find_fit succeed)\n");
+        return bp;
+    }
+
+    /* No fit found. Get more memory and place the block */
+    extendsize = MAX(asize,CHUNKSIZE);
+    if ((bp = extend_heap(a, extendsize/FSIZE)) == NULL) { 
+        dbg_checkheap(a, __LINE__, 0);
+        dbg_printf("END MALLOC (extend_heap Fails)\n");
+        return NULL;
+    }
+    if (dirty != NULL) {
+        get_dirty(a, bp, dirty);
+    }
+    place(a, bp, asize);
+    dbg_checkheap(a, __LINE__, 0);
+    dbg_printf("END MALLOC (extend_heap)\n");
+    return bp;
+}
+
+/*
+ Return the first block ptr at or after bp that is a multiple of align and 
+ leaves a fragment in front of it that is either empty or large enough to
+ be a block.
+ */
+static char *align_bp(void *bp, size_t align) {
+    char *abp = (char *)(((uintptr_t)bp + align - 1) & ~(uintptr_t)(align - 1));
+
+    /* More than once when align is smaller than the minimum block */
+    while (abp != bp && abp - (char *)bp < 4*FSIZE) {
+        abp += align;
+    }
+    return abp;
+}
+
+/*
+ Take a block of asize bytes whose block ptr is a multiple of align (a power
+ of 2) out of an arena. The free block it is carved from is either found in
+ the seglists or made by extending the heap just enough. The fragment in 
+ front of the aligned block and the remainder behind it are given back as 
+ free blocks. Called with the arena lock held.
+ */
+static void *malloc_aligned_block(arena_t *a, size_t align, size_t asize) {
+    char *bp, *abp;
+    size_t lead;
+
+    if (align <= ALIGNMENT) {
+        return malloc_block(a, asize, NULL);
+    }
+    if (a->heap_listp == 0){
+        if (init_heap(a) < 0) {
+            return NULL;
+        }
+    }
+    bp = find_fit_aligned(a, align, asize);
+    #ifndef NO_QUICK
+    if (bp == NULL && a->quick_bytes > 0) {
+        quick_sweep(a);
+        bp = find_fit_aligned(a, align, asize);
+    }
+    #endif
+    if (bp == NULL) {
+        /* Extend the heap so that the last block, coalesced with the new
+        space, ends right behind the aligned block */
+        char *epi = a->heap_brk;
+        char *start = GET_PREV_ALLOC(HDRP(epi)) ? epi : PREV_BLKP(epi);
+        abp = align_bp(start, align);
+        if ((bp = extend_heap(a, (abp + asize - epi) / FSIZE)) == NULL) {
+            return NULL;
+        }
+    }
+    /* Allocate the whole free block, then cut it down to the aligned one */
+    place(a, bp, GET_SIZE(HDRP(bp)));
+    abp = align_bp(bp, align);
+    lead = abp - bp;
+    if (lead > 0) {
+        size_t csize = GET_SIZE(HDRP(bp));
+        STAT_ADD(a, nsplit, 1);
+        PUT(HDRP(abp), PACK(csize - lead, 1, 1));
+        PUT(HDRP(bp), PACK(lead, 1, GET_PREV_ALLOC(HDRP(bp))));
+        free_block(a, bp);
+    }
+    shrink_block(a, abp, asize);
+    return abp;
+}
+
+/*
+ Cut the allocated block pointed by bp down to asize bytes. The remainder is
+ given back to the arena when it is large enough to be a block. Called with
+ the arena lock held.
+ */
+static void shrink_block(arena_t *a, void *bp, size_t asize) {
+    size_t csize = GET_SIZE(HDRP(bp));
+
+    if ((csize - asize) >= (4*FSIZE)) {
+        STAT_ADD(a, nsplit, 1);
+        PUT(HDRP(bp), PACK(asize, 1, GET_PREV_ALLOC(HDRP(bp))));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(csize - asize, 1, 1));
+        free_block(a, NEXT_BLKP(bp));
+    }
+}
+
+/*
+ Free the memory block pointed by bp. The block goes back to the arena that
+ owns it, whichever thread frees it.
+ */
+void free(void *bp) {
+    dbg_printf("FREE\n");
+
+    if (bp == 0) {
+        return;
+    }
+    /* Recorded first, as the block may be reused as soon as it is freed */
+    TRACE_CALL(MM_TRACE_FREE, bp, NULL, 0);
+    PROF_FREE(bp);
+
+    /* debug garbled bytes */
+    #ifdef DEBUG_BYTES
+    remove_from_user_mm_array(bp);
+    #endif
+
+    #ifndef NO_SLAB
+    int cls = pagemap_get(bp);
+    if (cls > 0) {
+        stats_resize(SLAB_SLOT_SIZE(cls - 1), 0);
+        #ifdef MM_THREADS
+        tcache_free(bp, TC_SLAB_BIN(cls - 1));
+        #else
+        slab_free(arena_of(bp), bp);
+        #endif
+        return;
+    }
+    #endif
+
+    stats_resize(block_usable(bp), 0);
+    if (GET_MMAPPED(HDRP(bp))) {
+        mmap_free(bp);
+        return;
+    }
+
+    #ifdef MM_THREADS
+    size_t size = GET_SIZE(HDRP(bp));
+    if (size < TC_MAX_ASIZE) {
+        tcache_free(bp, TC_BIN(size));
+        return;
+    }
+    #endif
+
+    arena_t *a = arena_of(bp);
+    LOCK_ARENA(a);
+    release_block(a, bp);
+    UNLOCK_ARENA(a);
+
+    dbg_printf("END FREE\n");
+}
+
+/*
+ Allocate n blocks of size bytes and store them in out. Blocks are carved
+ one behind the other out of spans of up to BATCH_SPAN bytes, each taken 
+ with one search of the seglist, under one lock of the arena. Return the 
+ number of blocks stored, which is less than n only if memory runs out.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out) {
+    size_t i = 0, k;
+    size_t usable = 0; /* Usable bytes of the slots, which have no header */
+
+    if (size == 0) {
+        return 0;
+    }
+    if (size < mmap_threshold) {
+        arena_t *a = arena_get();
+        #ifdef NO_SLAB
+        i = malloc_batch(a, adjust_size(size), n, out);
+        #else
+        if (size > SLAB_MAX) {
+            i = malloc_batch(a, adjust_size(size), n, out);
+        } else {
+            while (i < n && 
+                (out[i] = slab_malloc(a, SLAB_CLASS(size))) != NULL) {
+                i ++;
+            }
+            usable = SLAB_SLOT_SIZE(SLAB_CLASS(size));
+        }
+        #endif
+        UNLOCK_ARENA(a);
+        for (k = 0; k < i; k ++) {
+            stats_malloc(size, usable > 0 ? usable : block_usable(out[k]));
+            TRACE_CALL(MM_TRACE_MALLOC, out[k], NULL, size);
+            PROF_MALLOC(out[k], size);
+        }
+
+        /* debug garbled bytes */
+        #ifdef DEBUG_BYTES
+        size_t j;
+        for (j = 0; j < i; j ++) {
+            add_to_user_mm_array(out[j], size);
+        }
+        #endif
+    }
+    /* The rest one by one, from mappings, other arenas or normal blocks */
+    while (i < n && (out[i] = malloc(size)) != NULL) {
+        i ++;
+    }
+    return i;
+}
+
+/*
+ Carve as many as n blocks of asize bytes out of an arena into out, first 
+ from the quick list of the size, then from spans of the seglist. Return the
+ number of blocks carved. Called with the arena lock held.
+ */
+static size_t malloc_batch(arena_t *a, size_t asize, size_t n, void **out) {
+    size_t i = 0;
+
+    #ifndef NO_QUICK
+    if (asize < QUICK_MAX_ASIZE && a->heap_listp != 0) {
+        while (i < n && a->quick[QUICK_BIN(asize)] != NULL) {
+            out[i] = a->quick[QUICK_BIN(asize)];
+            a->quick[QUICK_BIN(asize)] = QUICK_NEXT(out[i]);
+            a->quick_bytes -= asize;
+            i ++;
+        }
+    }
+    #endif
+    while (i < n) {
+        size_t k = MIN(n - i, MAX(BATCH_SPAN / asize, 1));
+        char *bp = malloc_block(a, k * asize, NULL);
+        size_t span, j;
+        unsigned int prev_alloc;
+
+        if (bp == NULL) {
+            break;
+        }
+        /* Cut the span into k blocks, the last one keeping what place()
+        did not split off */
+        span = GET_SIZE(HDRP(bp));
+        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        for (j = 0; j < k; j ++) {
+            size_t bsize = j < k - 1 ? asize : span - (k - 1) * asize;
+            PUT(HDRP(bp), PACK(bsize, 1, prev_alloc));
+            out[i ++] = bp;
+            prev_alloc = 1;
+            bp += bsize;
+        }
+    }
+    return i;
+}
+
+static int ptr_cmp(const void *x, const void *y) {
+    char *p = *(char **)x, *q = *(char **)y;
+    return (p > q) - (p < q);
+}
+
+/*
+ Free the n pointers in ptrs, which is sorted in place. Blocks that lie 
+ right behind each other are joined before they are freed, so that each run
+ is coalesced once, and the blocks and slots of one arena are freed under 
+ one lock.
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    arena_t *locked = NULL;
+    size_t i, freed = 0;
+
+    for (i = 1; i < n && (char *)ptrs[i - 1] <= (char *)ptrs[i]; i ++) {
+    }
+    if (i < n) {
+        qsort(ptrs, n, sizeof(void *), ptr_cmp);
+    }
+    #if defined(TRACE) || defined(PROFILE)
+    for (i = 0; i < n; i ++) {
+        if (ptrs[i] != NULL) {
+            TRACE_CALL(MM_TRACE_FREE, ptrs[i], NULL, 0);
+            PROF_FREE(ptrs[i]);
+        }
+    }
+    #endif
+    i = 0;
+    while (i < n) {
+        char *bp = ptrs[i ++];
+
+        if (bp == NULL) {
+            continue;
+        }
+        /* debug garbled bytes */
+        #ifdef DEBUG_BYTES
+        remove_from_user_mm_array(bp);
+        #endif
+        #ifndef NO_SLAB
+        int cls = pagemap_get(bp);
+        #else
+        int cls = 0;
+        #endif
+        if (cls == 0 && GET_MMAPPED(HDRP(bp))) {
+            freed += block_usable(bp);
+            mmap_free(bp);
+            continue;
+        }
+        arena_t *a = arena_of(bp);
+        if (a != locked) {
+            if (locked != NULL) {
+                UNLOCK_ARENA(locked);
+            }
+            LOCK_ARENA(a);
+            locked = a;
+        }
+        #ifndef NO_SLAB
+        if (cls > 0) {
+            freed += SLAB_SLOT_SIZE(cls - 1);
+            slab_free(a, bp);
+            continue;
+        }
+        #endif
+
+        /* Join the run of blocks starting at bp */
+        size_t size = GET_SIZE(HDRP(bp));
+        freed += size - FSIZE;
+        while (i < n && ptrs[i] == bp + size) {
+            #ifdef DEBUG_BYTES
+            remove_from_user_mm_array(ptrs[i]);
+            #endif
+            freed += GET_SIZE(HDRP(ptrs[i])) - FSIZE;
+            size += GET_SIZE(HDRP(ptrs[i ++]));
+        }
+        PUT(HDRP(bp), PACK(size, 1, GET_PREV_ALLOC(HDRP(bp))));
+        VERIFY_MERGED(a, bp, bp + size);
+        release_block(a, bp);
+    }
+    if (locked != NULL) {
+        UNLOCK_ARENA(locked);
+    }
+    stats_resize(freed, 0);
+}
+
+/*
+ Give a block freed by the user back to its arena: on the quick list of its
+ size if it is small, otherwise freed and coalesced at once. Called with the
+ arena lock held.
+ */
+static void release_block(arena_t *a, void *bp) {
+    #ifndef NO_QUICK
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (size < QUICK_MAX_ASIZE) {
+        QUICK_NEXT(bp) = a->quick[QUICK_BIN(size)];
+        a->quick[QUICK_BIN(size)] = bp;
+        a->quick_bytes += size;
+        if (a->quick_bytes > QUICK_LIMIT) {
+            quick_sweep(a);
+        }
+        return;
+    }
+    #endif
+    free_block(a, bp);
+}
+
+#ifndef NO_QUICK
+/*
+ Free and coalesce every block on the quick lists of an arena. Called with
+ the arena lock held.
+ */
+static void quick_sweep(arena_t *a) {
+    int i;
+
+    for (i = 0; i < QUICK_NBINS; i ++) {
+        void *bp;
+        while ((bp = a->quick[i]) != NULL) {
+            a->quick[i] = QUICK_NEXT(bp);
+            a->quick_bytes -= GET_SIZE(HDRP(bp));
+            free_block(a, bp);
+        }
+    }
+}
+#endif
+
+/*
+ Give the block pointed by bp back to its arena and coalesce it. Called with
+ the arena lock held.
+ */
+static void free_block(arena_t *a, void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    /* Change the state of this block to free */
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    PUT(HDRP(bp), PACK(size, 0, prev_alloc));
+    PUT(FTRP(bp), PACK(size, 0, prev_alloc));
+
+    void *next_bp = NEXT_BLKP(bp);
+
+    /* change the prev_allocated bit of next block */
+    word_t block_size = GET_SIZE(HDRP(next_bp));
+    unsigned int block_alloced = GET_ALLOC(HDRP(next_bp));
+    PUT(HDRP(next_bp), PACK(block_size, block_alloced, 0));
+    if (!block_alloced) {
+        /*the next block is free, so it has a footer */
+        PUT(FTRP(next_bp), PACK(block_size, block_alloced, 0));
+    }
+    coalesce(a, bp);
+}
+
+/*
+ Resize the allocated block pointed by bp to asize bytes without moving it.
+ A shrunk block gives its tail back as a free block. A growing block 
+ absorbs the free block behind it, and when it is the last block of the 
+ heap, the heap is extended by what is still missing. Return 0 if the 
+ block has to move. Called with the arena lock held.
+ */
+static int realloc_block(arena_t *a, void *bp, size_t asize) {
+    size_t csize = GET_SIZE(HDRP(bp));
+    char *next_bp = NEXT_BLKP(bp);
+    size_t nsize = GET_ALLOC(HDRP(next_bp)) ? 0 : GET_SIZE(HDRP(next_bp));
+
+    if (asize > MAX_BLOCK) {
+        /* A huge block can only move to a mapping */
+        return 0;
+    }
+    if (asize > csize + nsize) {
+        /* Is the block or the free block behind it the last one? */
+        char *last = nsize ? NEXT_BLKP(next_bp) : next_bp;
+        if (GET_SIZE(HDRP(last)) != 0) {
+            return 0;
+        }
+        if (extend_heap(a, (asize - csize - nsize)/FSIZE) == NULL) {
+            return 0;
+        }
+        /* The new space is coalesced with the free block behind bp */
+        nsize = GET_SIZE(HDRP(next_bp));
+    }
+    if (nsize > 0) {
+        list_remove(a, next_bp);
+        PUT(HDRP(bp), PACK(csize + nsize, 1, GET_PREV_ALLOC(HDRP(bp))));
+        VERIFY_MERGED(a, bp, (char *)bp + csize + nsize);
+        mark_dirty(a, bp);
+        /* The block behind was free, so the one after it is allocated */
+        next_bp = NEXT_BLKP(bp);
+        PUT(HDRP(next_bp), GET(HDRP(next_bp)) | 0x2);
+    }
+    shrink_block(a, bp, asize);
+    dbg_checkheap(a, __LINE__, 0);
+    return 1;
+}
+
+/*
+ Reallocated the memory block pointed by ptr to a block of size bytes. A 
+ block is resized in place when its neighbourhood allows and a mapped block
+ is remapped, otherwise the payload is moved to a new block.
+ */
+void *realloc(void *ptr, size_t size) {
+    size_t oldsize;
+    void *newptr;
+
+    /* If size == 0 then this is just free, and we return NULL. */
+    if(size == 0) {
+        free(ptr);
+        return 0;
+    }
+
+    /* If oldptr is NULL, then this is just malloc. */
+    if(ptr == NULL) {
+        return malloc(size);
+    }
+
+    oldsize = usable_size(ptr);
+    #ifndef NO_SLAB
+    /* A slot is kept while the request still fits in it */
+    if (size <= oldsize && pagemap_get(ptr) > 0) {
+        TRACE_CALL(MM_TRACE_REALLOC, ptr, ptr, size);
+        PROF_FREE(ptr);
+        PROF_MALLOC(ptr, size);
+        #ifdef DEBUG_BYTES
+        remove_from_user_mm_array(ptr);
+        add_to_user_mm_array(ptr, size);
+        #endif
+        return ptr;
+    }
+    #endif
+    if (is_mmapped(ptr)) {
+        /* A mapping that stays above the threshold is remapped. While
+        calls are recorded it stays in place, as a move frees the old
+        address and takes the new one in one call. */
+        if (size >= mmap_threshold &&
+            (newptr = mmap_realloc(ptr, size, !TRACE_ACTIVE())) != NULL) {
+            stats_resize(oldsize, block_usable(newptr));
+            TRACE_CALL(MM_TRACE_REALLOC, newptr, ptr, size);
+            PROF_FREE(ptr);
+            PROF_MALLOC(newptr, size);
+            #ifdef DEBUG_BYTES
+            remove_from_user_mm_array(ptr);
+            add_to_user_mm_array(newptr, size);
+            #endif
+            return newptr;
+        }
+    } else if (size < mmap_threshold
+        #ifndef NO_SLAB
+        && pagemap_get(ptr) == 0
+        #endif
+        ) {
+        arena_t *a = arena_of(ptr);
+        int done;
+        /* debug garbled bytes: the tail of the block may be freed */
+        #ifdef DEBUG_BYTES
+        size_t user_size = remove_from_user_mm_array(ptr);
+        #endif
+        LOCK_ARENA(a);
+        done = realloc_block(a, ptr, adjust_size(size));
+        UNLOCK_ARENA(a);
+        #ifdef DEBUG_BYTES
+        add_to_user_mm_array(ptr, done ? size : user_size);
+        #endif
+        if (done) {
+            stats_resize(oldsize, block_usable(ptr));
+            TRACE_CALL(MM_TRACE_REALLOC, ptr, ptr, size);
+            PROF_FREE(ptr);
+            PROF_MALLOC(ptr, size);
+            return ptr;
+        }
+    }
+
+    TRACE_HOLD(1);
+    newptr = malloc(size);
+    TRACE_HOLD(-1);
+
+    /* If realloc() fails the original block is left untouched  */
+    if(!newptr) {
+        return 0;
+    }
+
+    /* Copy the old data. */
+    if(size < oldsize) oldsize = size;
+    memcpy(newptr, ptr, oldsize);
+    TRACE_CALL(MM_TRACE_REALLOC, newptr, ptr, size);
+
+    /* Free the old block. */
+    TRACE_HOLD(1);
+    free(ptr);
+    TRACE_HOLD(-1);
+
+    return newptr;
+}
+
+/*
+ Clear n bytes at p. If n is large and p lies in an arena mapping (drop set),
+ the whole pages are dropped with madvise() instead, to be refilled with 
+ zero pages on first touch.
+ */
+static void clear_span(char *p, size_t n, int drop) {
+    if (drop && n >= ZERO_PAGES_MIN) {
+        char *lo = (char *)PAGE_UP(p);
+        char *hi = (char *)PAGE_DOWN(p + n);
+        memset(p, 0, lo - p);
+        madvise(lo, hi - lo, MADV_DONTNEED);
+        memset(hi, 0, p + n - hi);
+    } else {
+        memset(p, 0, n);
+    }
+}
+
+/*
+ malloc with content of memory initialized to zero. Of a large block only 
+ the part that was not in the clean part of the heap is cleared, less the
+ pages that mm_trim() dropped, which are still zero.
+ */
+void *calloc (size_t nmemb, size_t size) {
+    size_t bytes;
+    dirty_t dirty;
+    char *newptr;
+
+    /* nmemb * size must not wrap around */
+    if (size != 0 && nmemb > (size_t)-1 / size) {
+        return NULL;
+    }
+    bytes = nmemb * size;
+
+    if (bytes < CALLOC_BLOCK_MIN) {
+        TRACE_HOLD(1);
+        newptr = malloc(bytes);
+        TRACE_HOLD(-1);
+        if (newptr == NULL) {
+            return NULL;
+        }
+        /* Hide the block from the compiler, which would turn malloc() and
+        memset() back into a call of calloc() */
+        __asm__("" : "+r" (newptr));
+        memset(newptr, 0, bytes);
+        TRACE_CALL(MM_TRACE_CALLOC, newptr, NULL, bytes);
+        return newptr;
+    }
+    if ((bytes >= mmap_threshold || adjust_size(bytes) > MAX_BLOCK) &&
+        (newptr = mmap_malloc(bytes)) != NULL) {
+        /* Fresh pages are zero */
+        stats_malloc(bytes, block_usable(newptr));
+        TRACE_CALL(MM_TRACE_CALLOC, newptr, NULL, bytes);
+        PROF_MALLOC(newptr, bytes);
+        #ifdef DEBUG_BYTES
+        add_to_user_mm_array(newptr, bytes);
+        #endif
+        return newptr;
+    }
+
+    newptr = arena_malloc(adjust_size(bytes), &dirty);
+    if (newptr == NULL) {
+        return NULL;
+    }
+    stats_malloc(bytes, block_usable(newptr));
+    TRACE_CALL(MM_TRACE_CALLOC, newptr, NULL, bytes);
+    PROF_MALLOC(newptr, bytes);
+    /* Link fields and FTR left from the free block */
+    dirty.bytes = MAX(MIN(dirty.bytes, bytes), MAX_LINK_FIELDS*FSIZE);
+    dirty.skip_hi = MIN(dirty.skip_hi, dirty.bytes);
+    memset(FTRP(newptr), 0, FSIZE);
+    int drop = arena_of(newptr)->region_lo != NULL;
+    if (dirty.skip_lo < dirty.skip_hi) {
+        clear_span(newptr, dirty.skip_lo, drop);
+        clear_span(newptr + dirty.skip_hi, dirty.bytes - dirty.skip_hi, drop);
+    } else {
+        clear_span(newptr, dirty.bytes, drop);
+    }
+
+    /* debug garbled bytes */
+    #ifdef DEBUG_BYTES
+    add_to_user_mm_array(newptr, bytes);
+    #endif
+    return newptr;
+}
+
+/*
+ Allocate size bytes at an address that is a multiple of align, which is a
+ power of 2. Return 0 on success, EINVAL if align is 0 or not a power of 2
+ and a multiple of sizeof(void *), and ENOMEM if memory runs out.
+ */
+int posix_memalign(void **memptr, size_t align, size_t size) {
+    void *bp;
+
+    if (align == 0 || align % sizeof(void *) != 0 ||
+        (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    if (size == 0) {
+        *memptr = NULL;
+        return 0;
+    }
+    if ((bp = aligned_malloc(align, size)) == NULL) {
+        return ENOMEM;
+    }
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ Allocate size bytes at an address that is a multiple of align, which must
+ be a power of 2
+ */
+void *aligned_alloc(size_t align, size_t size) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return aligned_malloc(align, size);
+}
+
+/*
+ Allocate size bytes at an address that is a multiple of align. An align 
+ that is not a power of 2 is rounded up to one.
+ */
+void *memalign(size_t align, size_t size) {
+    if ((align & (align - 1)) != 0 && align < MAX_ALIGN) {
+        align = (size_t)1 << (8*sizeof(size_t) - __builtin_clzl(align));
+    }
+    return aligned_malloc(align, size);
+}
+
+/*
+ Allocate size bytes aligned to align, a power of 2. A larger alignment than
+ malloc() gives is served by a block, carved out of a free block or the top
+ of the heap so that the fragment in front of it goes back to the seglist
+ instead of being lost in an oversized block. As in malloc(), a request of
+ at least mmap_threshold bytes gets an aligned mapping of its own.
+ */
+static void *aligned_malloc(size_t align, size_t size) {
+    arena_t *a;
+    size_t asize;
+    char *bp = NULL;
+
+    if (align <= ALIGNMENT) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        return NULL;
+    }
+    if (align >= MAX_ALIGN) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (size >= mmap_threshold || size >= MAX_ALIGN) {
+        /* A block too large for an aligned heap block can only be a
+        mapping */
+        bp = mmap_aligned(align, size);
+    }
+    if (bp == NULL && size < MAX_ALIGN) {
+        asize = adjust_size(size);
+        a = arena_get();
+        bp = malloc_aligned_block(a, align, asize);
+        UNLOCK_ARENA(a);
+        if (bp == NULL && a != &arenas[0]) {
+            a = &arenas[0];
+            LOCK_ARENA(a);
+            bp = malloc_aligned_block(a, align, asize);
+            UNLOCK_ARENA(a);
+        }
+        #ifdef MM_THREADS
+        int fresh;
+        /* As in arena_malloc(), a block and its fragment over half a region
+        are left to fail rather than reserve regions they never fit in */
+        for (fresh = 0; bp == NULL && fresh < 2 &&
+            asize + align <= ARENA_REGION/2; fresh ++) {
+            if ((a = arena_overflow(fresh)) != NULL) {
+                LOCK_ARENA(a);
+                bp = malloc_aligned_block(a, align, asize);
+                UNLOCK_ARENA(a);
+            }
+        }
+        #endif
+    }
+    if (bp != NULL) {
+        stats_malloc(size, block_usable(bp));
+        TRACE_CALL(MM_TRACE_MALLOC, bp, NULL, size);
+        PROF_MALLOC(bp, size);
+    }
+
+    /* debug garbled bytes */
+    #ifdef DEBUG_BYTES
+    if (bp != NULL) {
+        add_to_user_mm_array(bp, size);
+    }
+    #endif
+    return bp;
+}
+
+/*
+ Give free memory of all heaps back to the OS and return the number of bytes
+ given back. Each heap is cut down to end right after its last allocated
+ block plus pad bytes. Any other free block keeps its fields, but the whole
+ pages inside it are dropped with madvise(), to be refilled with zero on the
+ next touch.
+ */
+size_t mm_trim(size_t pad) {
+    size_t released = 0;
+    int i;
+
+    #ifdef MM_THREADS
+    /* Cached blocks of the caller may make larger free blocks */
+    tcache_t *tc = tcache_get();
+    for (i = 0; i < TC_NBINS; i ++) {
+        tcache_drain(tc, i, TC_CAPACITY);
+    }
+    #endif
+
+    for (i = 0; i < n_arenas; i ++) {
+        arena_t *a = &arenas[i];
+        LOCK_ARENA(a);
+        #ifndef NO_QUICK
+        quick_sweep(a);
+        #endif
+        if (a->heap_listp != 0) {
+            int level;
+
+            if (!GET_PREV_ALLOC(HDRP(a->heap_brk))) {
+                released += trim_top(a, PREV_BLKP(a->heap_brk), pad);
+            }
+            /* Only blocks from the level of a page up can hold a page */
+            for (level = next_level(a, get_level(PAGE_SIZE)); level >= 0; 
+                level = next_level(a, level + 1)) {
+                char *bp = level_first(a, level);
+                for (; bp != a->tail; bp = level_next(a, level, bp)) {
+                    released += trim_block(bp);
+                }
+            }
+        }
+        UNLOCK_ARENA(a);
+    }
+    return released;
+}
+
+/*
+ Sum the counters of all arenas and threads into stats. Each arena is locked
+ in turn, so the sums are consistent per arena but not across arenas.
+ */
+void mm_stats(struct mm_stats *stats) {
+    size_t used;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < n_arenas; i ++) {
+        arena_t *a = &arenas[i];
+        LOCK_ARENA(a);
+        if (a->heap_listp != 0) {
+            int level;
+            for (level = 0; level < N_LISTS; level ++) {
+                char *bp = level_first(a, level);
+                for (; bp != a->tail; bp = level_next(a, level, bp)) {
+                    size_t size = GET_SIZE(HDRP(bp));
+                    int lvl = MIN(WORD_MSB(size) - 4, MM_STATS_LEVELS - 1);
+                    stats->free_count[lvl] ++;
+                    stats->free_bytes[lvl] += size;
+                }
+            }
+            #ifndef NO_STATS
+            stats->splits += a->nsplit;
+            stats->coalesces += a->ncoalesce;
+            stats->extends += a->nextend;
+            #endif
+            stats->heap_bytes += a->heap_brk - a->heap_startp;
+        }
+        UNLOCK_ARENA(a);
+    }
+
+    #ifndef NO_STATS
+    {
+        #ifdef MM_THREADS
+        tcache_t *tc;
+        int k;
+
+        pthread_mutex_lock(&arenas_lock);
+        stats->live_bytes = retired_stats.live;
+        for (k = 0; k < MM_STATS_SIZES; k ++) {
+            stats->requests[k] = retired_stats.requests[k];
+        }
+        for (tc = tcache_list; tc != NULL; tc = tc->next) {
+            if (tc->gen != heap_gen) {
+                continue; /* Counted before the last mm_init() */
+            }
+            stats->live_bytes += __atomic_load_n(&tc->stats.live, 
+                __ATOMIC_RELAXED);
+            for (k = 0; k < MM_STATS_SIZES; k ++) {
+                stats->requests[k] += __atomic_load_n(&tc->stats.requests[k],
+                    __ATOMIC_RELAXED);
+            }
+        }
+        pthread_mutex_unlock(&arenas_lock);
+        #else
+        stats->live_bytes = req_stats.live;
+        memcpy(stats->requests, req_stats.requests, sizeof(stats->requests));
+        #endif
+    }
+    stats->mapped_bytes = __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    #endif
+
+    /* A block freed by another thread may be counted out before it is
+    counted in, so live_bytes is clamped */
+    used = stats->heap_bytes + stats->mapped_bytes;
+    if ((ssize_t)stats->live_bytes < 0) {
+        stats->live_bytes = 0;
+    }
+    stats->fragmentation = used == 0 || stats->live_bytes >= used ? 0.0 :
+        1.0 - (double)stats->live_bytes / used;
+}
+
+#ifdef TRACE
+/*
+ Take a chunk from the pool, or map a new one. Return NULL if out of memory.
+ Called with trace_lock held.
+ */
+static trace_chunk_t *trace_chunk_get(void) {
+    trace_chunk_t *c = trace_pool;
+
+    if (c != NULL) {
+        trace_pool = c->next;
+    } else {
+        c = mmap(NULL, TRACE_CHUNK_SIZE, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (c == MAP_FAILED) {
+            return NULL;
+        }
+    }
+    c->count = 0;
+    return c;
+}
+
+/*
+ Queue a chunk for the writer. Called with trace_lock held.
+ */
+static void trace_chunk_put(trace_chunk_t *c) {
+    c->next = NULL;
+    if (trace_tail != NULL) {
+        trace_tail->next = c;
+    } else {
+        trace_head = c;
+    }
+    trace_tail = c;
+    pthread_cond_signal(&trace_cond);
+}
+
+/*
+ Destructor of trace_key. A thread that exits queues its records and leaves
+ trace_threads.
+ */
+static void trace_exit(void *arg) {
+    trace_local_t *tl = arg;
+
+    pthread_mutex_lock(&trace_lock);
+    if (tl->chunk != NULL) {
+        if (tl->session == trace_session && trace_on) {
+            trace_chunk_put(tl->chunk);
+        } else {
+            tl->chunk->next = trace_pool;
+            trace_pool = tl->chunk;
+        }
+        tl->chunk = NULL;
+    }
+    if (tl->linked) {
+        if (tl->prev != NULL) {
+            tl->prev->next = tl->next;
+        } else {
+            trace_threads = tl->next;
+        }
+        if (tl->next != NULL) {
+            tl->next->prev = tl->prev;
+        }
+        tl->linked = 0;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_key_init(void) {
+    pthread_key_create(&trace_key, trace_exit);
+}
+
+/*
+ Queue the full chunk of the calling thread and take an empty one. Records
+ left from an earlier session are dropped instead.
+ */
+static void trace_flush(trace_local_t *tl) {
+    if (!tl->linked) {
+        pthread_once(&trace_once, trace_key_init);
+        tl->hold ++;
+        pthread_setspecific(trace_key, tl);
+        tl->hold --;
+    }
+    pthread_mutex_lock(&trace_lock);
+    if (!tl->linked) {
+        tl->prev = NULL;
+        tl->next = trace_threads;
+        if (trace_threads != NULL) {
+            trace_threads->prev = tl;
+        }
+        trace_threads = tl;
+        tl->linked = 1;
+    }
+    if (tl->chunk != NULL && tl->session == trace_session && trace_on) {
+        trace_chunk_put(tl->chunk);
+        tl->chunk = NULL;
+    }
+    if (tl->chunk == NULL) {
+        tl->chunk = trace_chunk_get();
+    } else {
+        tl->chunk->count = 0;
+    }
+    tl->session = trace_session;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+ Append a record of a call to the chunk of the calling thread
+ */
+static void trace_record(int op, void *ptr, void *old, size_t size) {
+    trace_local_t *tl = &trace_self;
+    struct mm_trace_rec *r;
+    size_t n;
+
+    if (tl->hold > 0) {
+        return;
+    }
+    if (tl->chunk == NULL || tl->chunk->count == TRACE_CHUNK_RECS ||
+        tl->session != __atomic_load_n(&trace_session, __ATOMIC_RELAXED)) {
+        trace_flush(tl);
+        if (tl->chunk == NULL) {
+            return; /* Out of memory for records */
+        }
+    }
+    n = tl->chunk->count;
+    r = &tl->chunk->recs[n];
+    /* Ordered with the locks and atomics that hand blocks between threads */
+    r->seq = __atomic_fetch_add(&trace_seq, 1, __ATOMIC_SEQ_CST);
+    r->ptr = (uintptr_t)ptr;
+    r->old = (uintptr_t)old;
+    r->size = (uint64_t)size | (uint64_t)op << 56;
+    /* mm_trace_stop() may copy the records of the chunk at any time */
+    __atomic_store_n(&tl->chunk->count, n + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ Body of the writer thread: write queued chunks until mm_trace_stop() and 
+ the queue is empty
+ */
+static void *trace_write(void *arg) {
+    trace_chunk_t *c;
+    (void)arg;
+
+    pthread_mutex_lock(&trace_lock);
+    for (;;) {
+        while (trace_head == NULL && !trace_stopping) {
+            pthread_cond_wait(&trace_cond, &trace_lock);
+        }
+        if ((c = trace_head) == NULL) {
+            break;
+        }
+        trace_head = c->next;
+        if (trace_head == NULL) {
+            trace_tail = NULL;
+        }
+        pthread_mutex_unlock(&trace_lock);
+
+        char *buf = (char *)c->recs;
+        size_t left = c->count * sizeof(struct mm_trace_rec);
+        while (left > 0) {
+            ssize_t done = write(trace_fd, buf, left);
+            if (done < 0 && errno == EINTR) {
+                continue;
+            }
+            if (done <= 0) {
+                break; /* The rest of the chunk is lost */
+            }
+            buf += done;
+            left -= done;
+        }
+
+        pthread_mutex_lock(&trace_lock);
+        c->next = trace_pool;
+        trace_pool = c;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return NULL;
+}
+
+/*
+ Start recording every malloc(), free(), realloc() and calloc() of every 
+ thread to the file at path. Return 0, or -1 with errno set.
+ */
+int mm_trace_start(const char *path) {
+    uint64_t magic = MM_TRACE_MAGIC;
+    int fd, rt;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        return -1;
+    }
+    if (write(fd, &magic, sizeof(magic)) != sizeof(magic)) {
+        close(fd);
+        return -1;
+    }
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        pthread_mutex_unlock(&trace_lock);
+        close(fd);
+        errno = EBUSY;
+        return -1;
+    }
+    trace_fd = fd;
+    trace_stopping = 0;
+    if ((rt = pthread_create(&trace_writer, NULL, trace_write, NULL)) != 0) {
+        trace_fd = -1;
+        pthread_mutex_unlock(&trace_lock);
+        close(fd);
+        errno = rt;
+        return -1;
+    }
+    trace_session ++;
+    __atomic_store_n(&trace_on, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_lock);
+    return 0;
+}
+
+/*
+ Stop recording, write out the records of every thread and close the trace.
+ A call that races with mm_trace_stop() in another thread may be left out.
+ */
+void mm_trace_stop(void) {
+    trace_local_t *tl;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd < 0 || trace_stopping) {
+        pthread_mutex_unlock(&trace_lock);
+        return;
+    }
+    __atomic_store_n(&trace_on, 0, __ATOMIC_RELAXED);
+    /* Other threads keep their chunks, so their records are copied */
+    for (tl = trace_threads; tl != NULL; tl = tl->next) {
+        trace_chunk_t *c;
+        size_t n;
+
+        if (tl->session != trace_session || tl->chunk == NULL) {
+            continue;
+        }
+        n = __atomic_load_n(&tl->chunk->count, __ATOMIC_ACQUIRE);
+        if (n > 0 && (c = trace_chunk_get()) != NULL) {
+            memcpy(c->recs, tl->chunk->recs, n * sizeof(struct mm_trace_rec));
+            c->count = n;
+            trace_chunk_put(c);
+        }
+    }
+    trace_session ++;
+    trace_stopping = 1;
+    pthread_cond_signal(&trace_cond);
+    pthread_mutex_unlock(&trace_lock);
+
+    pthread_join(trace_writer, NULL);
+    pthread_mutex_lock(&trace_lock);
+    close(trace_fd);
+    trace_fd = -1;
+    trace_stopping = 0;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+#ifndef DRIVER
+/*
+ Record the whole run of a program when MM_TRACE names a trace file
+ */
+__attribute__((constructor))
+static void trace_from_env(void) {
+    const char *path = getenv("MM_TRACE");
+
+    if (path != NULL && path[0] != '\0' && mm_trace_start(path) == 0) {
+        atexit(mm_trace_stop);
+    }
+}
+#endif
+#else
+int mm_trace_start(const char *path) {
+    (void)path;
+    errno = ENOSYS;
+    return -1;
+}
+
+void mm_trace_stop(void) {
+}
+#endif
+
+#ifdef PROFILE
+#define PROF_SAMPLES (1 << PROF_SAMPLE_BITS)
+#define PROF_STACKS  (1 << PROF_STACK_BITS)
+
+/*
+ Bytes to the next sample: an exponential variate of mean rate, so that
+ samples are a Poisson process over the bytes allocated. -log2 of a uniform
+ variate is the number of leading zeros of a random word, plus the log of
+ the bits below the leading one, fitted by a parabola.
+ */
+static long prof_interval(size_t rate) {
+    uint64_t r;
+    int e;
+    double frac;
+
+    prof_rnd ^= prof_rnd << 13;
+    prof_rnd ^= prof_rnd >> 7;
+    prof_rnd ^= prof_rnd << 17;
+    r = prof_rnd;
+    e = __builtin_clzll(r);
+    frac = (double)((r << e) << 1 >> 12) / (double)(1ULL << 52);
+    frac += 0.34 * frac * (1 - frac);
+    return (long)((e + 1 - frac) * 0.6931471805599453 * (double)rate) + 1;
+}
+
+static void prof_seed(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    prof_rnd = ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec) ^
+        ((uintptr_t)&prof_rnd * 0x9e3779b97f4a7c15ULL);
+    if (prof_rnd == 0) {
+        prof_rnd = 1;
+    }
+}
+
+static void prof_filter_add(void *bp, int delta) {
+    unsigned char *f = &prof_filter[PROF_PTR_HASH(bp, PROF_FILTER_BITS)];
+
+    /* A saturated count stays, and only costs a look up */
+    if (*f != UCHAR_MAX) {
+        __atomic_store_n(f, *f + delta, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ Remove slot i of prof_samples, moving later slots of its run back so that
+ no search stops short. Called with prof_lock held.
+ */
+static void prof_remove(size_t i) {
+    prof_sample_t *s = &prof_samples[i];
+    size_t j = i;
+
+    s->stack->live_count --;
+    s->stack->live_bytes -= s->size;
+    prof_filter_add(s->ptr, -1);
+    prof_live --;
+    for (;;) {
+        size_t k;
+
+        j = (j + 1) & (PROF_SAMPLES - 1);
+        if (prof_samples[j].ptr == NULL) {
+            break;
+        }
+        /* Slot j may move to i unless its home lies in (i, j] */
+        k = PROF_PTR_HASH(prof_samples[j].ptr, PROF_SAMPLE_BITS);
+        if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+            prof_samples[i] = prof_samples[j];
+            i = j;
+        }
+    }
+    prof_samples[i].ptr = NULL;
+}
+
+/*
+ Find the stack of depth frames in pcs, or add it. Return NULL if the table
+ is full. Called with prof_lock held.
+ */
+static prof_stack_t *prof_stack_get(void **pcs, int depth) {
+    uint64_t h = (uint64_t)depth;
+    size_t i;
+    int k;
+
+    for (k = 0; k < depth; k ++) {
+        h = (h ^ (uintptr_t)pcs[k]) * 0x100000001b3ULL;
+    }
+    h |= 1;
+    i = PROF_HASH(h, PROF_STACK_BITS);
+    while (prof_stacks[i].hash != 0) {
+        if (prof_stacks[i].hash == h && prof_stacks[i].depth == depth &&
+            memcmp(prof_stacks[i].pcs, pcs, depth * sizeof(void *)) == 0) {
+            return &prof_stacks[i];
+        }
+        i = (i + 1) & (PROF_STACKS - 1);
+    }
+    if (4*(prof_nstacks + 1) > 3*PROF_STACKS) {
+        return NULL;
+    }
+    prof_nstacks ++;
+    prof_stacks[i].hash = h;
+    prof_stacks[i].depth = depth;
+    memcpy(prof_stacks[i].pcs, pcs, depth * sizeof(void *));
+    return &prof_stacks[i];
+}
+
+/*
+ Keep bp, a block of size bytes allocated from the call stack pcs, as a live
+ sample. The sample is dropped if a table is full. Called with prof_lock
+ held.
+ */
+static void prof_insert(void *bp, size_t size, void **pcs, int depth) {
+    prof_stack_t *st;
+    size_t i;
+
+    if (2*(prof_live + 1) > PROF_SAMPLES || 
+        (st = prof_stack_get(pcs, depth)) == NULL) {
+        return;
+    }
+    i = PROF_PTR_HASH(bp, PROF_SAMPLE_BITS);
+    while (prof_samples[i].ptr != NULL) {
+        if (prof_samples[i].ptr == bp) {
+            /* A free() that raced with a reuse of the address */
+            prof_remove(i);
+            prof_insert(bp, size, pcs, depth);
+            return;
+        }
+        i = (i + 1) & (PROF_SAMPLES - 1);
+    }
+    prof_samples[i].ptr = bp;
+    prof_samples[i].size = size;
+    prof_samples[i].stack = st;
+    prof_live ++;
+    prof_filter_add(bp, 1);
+    st->live_count ++;
+    st->live_bytes += size;
+    st->alloc_count ++;
+    st->alloc_bytes += size;
+}
+
+/*
+ Called when the count of the thread runs out, after bp was allocated with
+ size bytes. Not inlined, so that its caller is always the second frame.
+ */
+__attribute__((noinline))
+static void prof_sample(void *bp, size_t size) {
+    size_t rate = __atomic_load_n(&prof_rate, __ATOMIC_RELAXED);
+    void *pcs[PROF_DEPTH + 2];
+    int depth;
+
+    if (rate == 0) {
+        prof_countdown = PROF_IDLE;
+        return;
+    }
+    if (prof_rnd == 0) {
+        /* The first call of a thread only starts the count */
+        prof_seed();
+        prof_countdown = prof_interval(rate);
+        return;
+    }
+    prof_countdown = prof_interval(rate);
+    /* backtrace() allocates when it loads the unwinder */
+    if (prof_busy) {
+        return;
+    }
+    prof_busy = 1;
+    depth = backtrace(pcs, PROF_DEPTH + 2);
+    if (depth > 2) {
+        pthread_mutex_lock(&prof_lock);
+        prof_insert(bp, size, pcs + 2, depth - 2);
+        pthread_mutex_unlock(&prof_lock);
+    }
+    prof_busy = 0;
+}
+
+/*
+ Drop bp from the live samples if it is one
+ */
+static void prof_forget(void *bp) {
+    size_t i = PROF_PTR_HASH(bp, PROF_SAMPLE_BITS);
+
+    pthread_mutex_lock(&prof_lock);
+    while (prof_samples[i].ptr != NULL) {
+        if (prof_samples[i].ptr == bp) {
+            prof_remove(i);
+            break;
+        }
+        i = (i + 1) & (PROF_SAMPLES - 1);
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ Sample an allocation about every rate bytes from now on, or stop if rate is
+ 0. Other threads that are running notice within PROF_IDLE bytes. Samples
+ already kept stay until freed. Return the previous rate.
+ */
+size_t mm_profile_rate(size_t rate) {
+    size_t old;
+    void *pc;
+
+    if (rate != 0) {
+        /* Have backtrace() load what it needs now, not inside malloc() */
+        prof_busy ++;
+        backtrace(&pc, 1);
+        prof_busy --;
+    }
+    pthread_mutex_lock(&prof_lock);
+    if (rate != 0 && prof_samples == NULL) {
+        prof_sample_t *samples = mmap(NULL, PROF_SAMPLES * sizeof(*samples),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | 
+            MAP_NORESERVE, -1, 0);
+        prof_stack_t *stacks = mmap(NULL, PROF_STACKS * sizeof(*stacks),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | 
+            MAP_NORESERVE, -1, 0);
+
+        if (samples == MAP_FAILED || stacks == MAP_FAILED) {
+            if (samples != MAP_FAILED) {
+                munmap(samples, PROF_SAMPLES * sizeof(*samples));
+            }
+            if (stacks != MAP_FAILED) {
+                munmap(stacks, PROF_STACKS * sizeof(*stacks));
+            }
+            rate = 0;
+        } else {
+            prof_samples = samples;
+            prof_stacks = stacks;
+        }
+    }
+    old = prof_rate;
+    __atomic_store_n(&prof_rate, rate, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&prof_lock);
+    /* The calling thread, and threads yet to start, begin right away */
+    prof_countdown = 0;
+    return old;
+}
+
+/* Buffered output of a profile, written without allocating */
+typedef struct prof_out {
+    int fd;
+    int err;                /* errno of a failed write, else 0 */
+    size_t len;
+    char buf[4096];
+} prof_out_t;
+
+static void prof_flush(prof_out_t *out) {
+    size_t done = 0;
+
+    while (done < out->len && out->err == 0) {
+        ssize_t n = write(out->fd, out->buf + done, out->len - done);
+        if (n < 0 && errno != EINTR) {
+            out->err = errno;
+        } else if (n > 0) {
+            done += n;
+        }
+    }
+    out->len = 0;
+}
+
+__attribute__((format(printf, 2, 3)))
+static void prof_printf(prof_out_t *out, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(out->buf + out->len, sizeof(out->buf) - out->len, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && out->len + n >= sizeof(out->buf)) {
+        prof_flush(out);
+        va_start(ap, fmt);
+        n = vsnprintf(out->buf, sizeof(out->buf), fmt, ap);
+        va_end(ap);
+    }
+    if (n > 0) {
+        out->len += MIN((size_t)n, sizeof(out->buf) - 1 - out->len);
+    }
+}
+
+/*
+ Write the samples to path as a heap profile in the text format of
+ gperftools, which pprof reads along with the program:
+
+     heap profile: <live>: <live bytes> [<all>: <all bytes>] @ heap_v2/<rate>
+     <live>: <live bytes> [<all>: <all bytes>] @ <pc> <pc> ...
+     MAPPED_LIBRARIES:
+     <the contents of /proc/self/maps>
+
+ There is a line per call stack, with the samples not freed yet and all
+ samples since the profiler started; pprof scales them up by the rate.
+ Return 0, or -1 with errno set.
+ */
+int mm_profile_dump(const char *path) {
+    static prof_out_t out;  /* Under prof_lock, too large for a stack */
+    size_t live = 0, live_bytes = 0, all = 0, all_bytes = 0, i;
+    ssize_t n;
+    int fd, maps, k;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) 
+        < 0) {
+        return -1;
+    }
+    prof_busy ++;
+    pthread_mutex_lock(&prof_lock);
+    out.fd = fd;
+    out.err = 0;
+    out.len = 0;
+    for (i = 0; prof_stacks != NULL && i < PROF_STACKS; i ++) {
+        live += prof_stacks[i].live_count;
+        live_bytes += prof_stacks[i].live_bytes;
+        all += prof_stacks[i].alloc_count;
+        all_bytes += prof_stacks[i].alloc_bytes;
+    }
+    prof_printf(&out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", 
+        live, live_bytes, all, all_bytes, 
+        prof_rate != 0 ? prof_rate : (size_t)PROF_RATE);
+    for (i = 0; prof_stacks != NULL && i < PROF_STACKS; i ++) {
+        prof_stack_t *st = &prof_stacks[i];
+
+        if (st->alloc_count == 0) {
+            continue;
+        }
+        prof_printf(&out, "%zu: %zu [%zu: %zu] @", st->live_count, 
+            st->live_bytes, st->alloc_count, st->alloc_bytes);
+        for (k = 0; k < st->depth; k ++) {
+            prof_printf(&out, " 0x%lx", (unsigned long)(uintptr_t)st->pcs[k]);
+        }
+        prof_printf(&out, "\n");
+    }
+    prof_printf(&out, "\nMAPPED_LIBRARIES:\n");
+    prof_flush(&out);
+    if ((maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC)) >= 0) {
+        while ((n = read(maps, out.buf, sizeof(out.buf))) > 0) {
+            out.len = n;
+            prof_flush(&out);
+        }
+        close(maps);
+    }
+    k = out.err;
+    pthread_mutex_unlock(&prof_lock);
+    prof_busy --;
+    if (close(fd) != 0 && k == 0) {
+        k = errno;
+    }
+    if (k != 0) {
+        errno = k;
+        return -1;
+    }
+    return 0;
+}
+
+static int prof_pipe[2] = {-1, -1};       /* From the handler to prof_dumper */
+static char prof_prefix[PATH_MAX - 32];
+
+static void prof_handler(int signo) {
+    int saved = errno;
+    char c = 0;
+
+    (void)signo;
+    if (write(prof_pipe[1], &c, 1) < 0) {
+        /* The pipe is full, so a dump is coming anyway */
+    }
+    errno = saved;
+}
+
+/*
+ Write a profile for each byte from the signal handler. A handler may not
+ take prof_lock, as the thread it interrupts may hold it.
+ */
+static void *prof_dumper(void *arg) {
+    char path[PATH_MAX], c;
+    unsigned int seq = 0;
+
+    (void)arg;
+    for (;;) {
+        if (read(prof_pipe[0], &c, 1) != 1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NULL;
+        }
+        snprintf(path, sizeof(path), "%s.%d.%04u.heap", prof_prefix, 
+            (int)getpid(), seq ++);
+        mm_profile_dump(path);
+    }
+}
+
+/*
+ Write a profile to <prefix>.<pid>.<n>.heap each time signo arrives. The
+ dump is made by a thread of its own, woken by the handler through a pipe.
+ Return 0, or -1 with errno set.
+ */
+int mm_profile_signal(int signo, const char *prefix) {
+    struct sigaction sa;
+    pthread_t thread;
+    int rt;
+
+    if (strlen(prefix) >= sizeof(prof_prefix)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    pthread_mutex_lock(&prof_lock);
+    strcpy(prof_prefix, prefix);
+    if (prof_pipe[0] < 0) {
+        if (pipe2(prof_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+            pthread_mutex_unlock(&prof_lock);
+            return -1;
+        }
+        /* Only the handler end may not block */
+        fcntl(prof_pipe[0], F_SETFL, 0);
+        if ((rt = pthread_create(&thread, NULL, prof_dumper, NULL)) != 0) {
+            close(prof_pipe[0]);
+            close(prof_pipe[1]);
+            prof_pipe[0] = prof_pipe[1] = -1;
+            pthread_mutex_unlock(&prof_lock);
+            errno = rt;
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    pthread_mutex_unlock(&prof_lock);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = prof_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(signo, &sa, NULL);
+}
+
+#ifndef DRIVER
+/*
+ Profile the whole run of a program when MM_PROFILE names a prefix for the
+ profiles, which PROF_SIGNAL dumps. MM_PROFILE_RATE sets the rate.
+ */
+__attribute__((constructor))
+static void prof_from_env(void) {
+    const char *prefix = getenv("MM_PROFILE");
+    const char *rate = getenv("MM_PROFILE_RATE");
+
+    if (prefix != NULL && prefix[0] != '\0') {
+        mm_profile_rate(rate != NULL ? strtoul(rate, NULL, 0) : PROF_RATE);
+        mm_profile_signal(PROF_SIGNAL, prefix);
+    }
+}
+#endif
+#else
+size_t mm_profile_rate(size_t rate) {
+    (void)rate;
+    errno = ENOSYS;
+    return 0;
+}
+
+int mm_profile_dump(const char *path) {
+    (void)path;
+    errno = ENOSYS;
+    return -1;
+}
+
+int mm_profile_signal(int signo, const char *prefix) {
+    (void)signo;
+    (void)prefix;
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+/*
+ Cut the free block pointed by bp, the last block of a heap, down to pad
+ bytes, or remove it if pad is less than a block. The end of the heap is
+ lowered to the new epilogue and the pages above it are given back. Called
+ with the arena lock held.
+ */
+static size_t trim_top(arena_t *a, void *bp, size_t pad) {
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t keep = ALIGN(pad);
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    if (keep < 4*FSIZE) {
+        keep = 0;
+    }
+    if (keep >= size) {
+        return 0;
+    }
+    list_remove(a, bp);
+    if (keep > 0) {
+        PUT(HDRP(bp), PACK(keep, 0, prev_alloc));
+        PUT(FTRP(bp), PACK(keep, 0, prev_alloc));
+        list_insert(a, bp, keep);
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1, 0)); /* New epilogue header */
+    } else {
+        PUT(HDRP(bp), PACK(0, 1, prev_alloc)); /* New epilogue header */
+    }
+    VERIFY_MERGED(a, bp, (char *)bp + size);
+    a->clean_lo = MIN(a->clean_lo, (char *)bp + keep);
+    return arena_shrink(a, (char *)bp + keep);
+}
+
+/*
+ Drop the whole pages of the free block pointed by bp that lie between its 
+ list fields and its footer. Called with the lock of the arena owning the
+ block held.
+ */
+static size_t trim_block(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    uintptr_t lo, hi;
+
+    if (GET_TRIMMED(HDRP(bp)) || size < PAGE_SIZE) {
+        return 0;
+    }
+    lo = PAGE_UP((char *)bp + LINK_FIELDS(bp, size)*FSIZE);
+    hi = PAGE_DOWN(FTRP(bp));
+    if (lo >= hi) {
+        return 0;
+    }
+    madvise((void *)lo, hi - lo, MADV_DONTNEED);
+    PUT(HDRP(bp), GET(HDRP(bp)) | TRIMMED);
+    PUT(FTRP(bp), GET(FTRP(bp)) | TRIMMED);
+    return hi - lo;
+}
+
+/*
+ Return whether the pointer is in the heap.
+ */
+static int in_heap(arena_t *a, const void *p) {
+    return (char *)p < a->heap_brk && (char *)p >= a->heap_startp;
+}
+
+/*
+ Return whether the pointer is aligned.
+ */
+static int aligned(const void *p) {
+    return (size_t)ALIGN(p) == (size_t)p;
+}
+#ifdef TLSF
+/*
+ Get the list that holds blocks of size bytes, numbered fl * TLSF_SL + sl.
+ The first level fl comes from the highest set bit of size and the second
+ level sl from the TLSF_SL_SHIFT bits below it.
+*/
+static int get_level(word_t size) {
+    if (size < TLSF_SMALL) {
+        return size / (TLSF_SMALL / TLSF_SL);
+    }
+    int msb = WORD_MSB(size);
+    int fl = msb - (4 + TLSF_SL_SHIFT) + 1;
+    int sl = (size >> (msb - TLSF_SL_SHIFT)) - TLSF_SL;
+    return fl * TLSF_SL + sl;
+}
+
+/*
+ Get the list to search for a block of size bytes. The size is rounded up 
+ to the next list boundary, so that every block in the list and in the 
+ lists above fits and the head can be taken without a scan.
+ */
+static int get_fit_level(size_t size) {
+    if (size < TLSF_SMALL) {
+        size += TLSF_SMALL / TLSF_SL - 1;
+    } else {
+        size += (1UL << (63 - __builtin_clzl(size) - TLSF_SL_SHIFT)) - 1;
+    }
+    if (size > MAX_BLOCK) {
+        return TLSF_FL * TLSF_SL; /* Larger than any block */
+    }
+    return get_level(size);
+}
+
+/*
+ Mark a list non-empty in both levels of bitmaps
+ */
+static void map_set(arena_t *a, int level) {
+    a->sl_map[level / TLSF_SL] |= 1u << (level % TLSF_SL);
+    a->seg_map |= (word_t)1 << (level / TLSF_SL);
+}
+
+/*
+ Mark a list empty, and its first level empty if it has no other lists
+ */
+static void map_clear(arena_t *a, int level) {
+    int fl = level / TLSF_SL;
+    a->sl_map[fl] &= ~(1u << (level % TLSF_SL));
+    if (a->sl_map[fl] == 0) {
+        a->seg_map &= ~((word_t)1 << fl);
     }
-    user_mm_array[mm_array_tail].bp = bp;
-    user_mm_array[mm_array_tail].size = size;
-    mm_array_tail ++;
 }
 
-/* Remove a memory block in record array. Called when free() is called. */
-static void remove_from_user_mm_array(char *bp) {
-    int i = 0;
-    for (i = 0; i < mm_array_tail; i ++) {
-        if (user_mm_array[i].bp == bp) {
-            user_mm_array[i].bp = 0;
-            user_mm_array[i].size = 0;
-            return;
-        }
+/*
+ Return whether a list is marked non-empty
+ */
+static int map_test(arena_t *a, int level) {
+    if (level >= TLSF_FL * TLSF_SL) {
+        return 0; /* The spare list */
     }
-    printf("error free: no corresponding block in user mm array: %p\n", bp);
+    return (a->sl_map[level / TLSF_SL] >> (level % TLSF_SL)) & 1;
 }
 
-/* Check if a pointer points to user memory */
-static void check_access_user_memory(char *ptr, int lineno) {
-    int i = 0;
-    for (i = 0; i < mm_array_tail; i ++) {
-        if ((ptr >= user_mm_array[i].bp) && 
-            (ptr < user_mm_array[i].bp + user_mm_array[i].size)) {
-            printf("(%d) Invalid access user allocated memory, ptr: %p\n",
-             lineno, ptr);
+/*
+ Get the lowest non-empty list at or above level, or -1 if there is none.
+ One find-first-set on the second-level bitmap of the first level, and on
+ a miss one on the first-level bitmap.
+ */
+static int next_level(arena_t *a, int level) {
+    if (level >= TLSF_FL * TLSF_SL) {
+        return -1;
+    }
+    int fl = level / TLSF_SL;
+    unsigned int map = a->sl_map[fl] & (~0u << (level % TLSF_SL));
+    if (map == 0) {
+        word_t fl_map = fl + 1 < TLSF_FL ?
+            a->seg_map & (~(word_t)0 << (fl + 1)) : 0;
+        if (fl_map == 0) {
+            return -1;
         }
+        fl = WORD_CTZ(fl_map);
+        map = a->sl_map[fl];
     }
+    return fl * TLSF_SL + __builtin_ctz(map);
+}
+#else
+/*
+ Get the level of seglist that holds blocks of size bytes. The level is the
+ position of the highest set bit of size, found with count-leading-zeros.
+*/
+static int get_level(word_t size) {
+    /* Block size is at least 16, whose highest bit is bit 4 */
+    int k = WORD_MSB(size) - 4;
+    /* Block size falls into the highest level of seglist */
+    return k < N_SEGLIST ? k : N_SEGLIST - 1;
 }
-#endif
 
-/* Global variables */
-static char *heap_startp = 0; /* Pointer to start of heap */
-static char *heap_listp = 0;  /* Pointer to first block */ 
-static char *tail = 0;        /* End sentinel of all level of seglists */
+static void map_set(arena_t *a, int level) {
+    a->seg_map |= (word_t)1 << level;
+}
 
-/* Function prototypes for internal helper routines */
-static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize);
-static void *find_fit(size_t asize);
-static void *coalesce(void *bp);
-static void checkheap(int lineno, int verbose);
-static void printblock(void *bp); 
-static void checkblock(void *bp, int lineno);
-static size_t check_list(int lineno, int verbose);
-static void *get_root(unsigned int asize);
+static void map_clear(arena_t *a, int level) {
+    a->seg_map &= ~((word_t)1 << level);
+}
+
+static int map_test(arena_t *a, int level) {
+    return (a->seg_map >> level) & 1;
+}
 
 /*
- Initialize global variables and the heap including prologue block, 
- epilogue block, header of each level of seglist and tail of all levels 
- of seglist.
- Request the first free block.
+ Get the lowest non-empty level at or above level, or -1 if there is none
  */
-int mm_init(void) {
-    dbg_printf("INIT\n");
-
-    /* debug garbled bytes */
-    #ifdef DEBUG
-    memset(user_mm_array, 0, ARRAY_SIZE * sizeof(user_mm));
-    mm_array_tail = 0;
-    #endif
+static int next_level(arena_t *a, int level) {
+    word_t map = level < N_SEGLIST ?
+        a->seg_map & ~(((word_t)1 << level) - 1) : 0;
+    return map != 0 ? WORD_CTZ(map) : -1;
+}
+#endif
 
-    /* Create the initial empty heap */
-    if ((heap_startp = mem_sbrk((N_SEGLIST + 5)*FSIZE)) == (void *)-1) 
-        return -1;
+/*
+ Get the entrance to a level of seg_list
+*/
+static char *get_root(arena_t *a, int level) {
+    return a->heap_startp + ((level + 2)*FSIZE);
+}
 
-    PUT(heap_startp, 0); /* Address of tail and the SUCC field of tail */
-    PUT(heap_startp + (1*FSIZE), 0); /*PRED field of tail*/
-    tail = heap_startp;
+/*
+ Link a free block of size bytes at the head of its level of seglist, or in
+ address order if ADDR_ORDER is defined, and mark the level non-empty.
+ */
+static void list_insert(arena_t *a, void *bp, word_t size) {
+    int level = get_level(size);
+    void *root = get_root(a, level);
 
-    int i = 2;
-    for (i = 2; i < N_SEGLIST + 2; i ++) { /* header of each level of seglist */
-        // Initialize each seg_header and let them point to tail
-        PUT(heap_startp + (i*FSIZE), HEAP_OFFSET(tail)); 
+    #ifndef TLSF
+    if (level == TREE_LEVEL) {
+        tree_insert(a, bp);
+        map_set(a, level);
+        return;
     }
+    #endif
+    #ifdef ADDR_ORDER
+    /* Link bp behind the last block in front of it, found from the closest
+    block in front of it in the skip list */
+    if (size >= ADDR_MIN) {
+        char *update[SKIP_TIERS];
+        char *x = skip_find(a, level, bp, update);
+        int t, height = skip_height(bp, size);
 
-    PUT(heap_startp + ((N_SEGLIST + 2)*FSIZE),
-     PACK(2*FSIZE, 1, 1)); /* Prologue block header */
-    PUT(heap_startp + ((N_SEGLIST + 3)*FSIZE),
-     PACK(2*FSIZE, 1, 1)); /* Prologue block footer */
-    PUT(heap_startp + ((N_SEGLIST + 4)*FSIZE),
-     PACK(0, 1, 1)); /* Epilogue block header */
-    heap_listp = heap_startp + (N_SEGLIST + 3)*FSIZE;
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/FSIZE) == NULL){ 
-        return -1;
+        if (x != NULL) {
+            root = x;
+        }
+        while (SUCC_FREE_BLKP(a, root) != a->tail &&
+            SUCC_FREE_BLKP(a, root) < (char *)bp) {
+            root = SUCC_FREE_BLKP(a, root);
+        }
+        for (t = 1; t <= height; t ++) {
+            char *fwdp = SKIP_FWDP(a, level, update[t - 1], t);
+            PUT(SKIP_FWDP(a, level, bp, t), GET(fwdp));
+            PUT(fwdp, HEAP_OFFSET(a, bp));
+        }
     }
+    #endif
 
-    dbg_checkheap(__LINE__, 0);
-    dbg_printf("END INIT\n");
-    
-    return 0;
+    PUT(SUCCP(bp), HEAP_OFFSET(a, SUCC_FREE_BLKP(a, root)));
+    PUT(PREDP(bp), HEAP_OFFSET(a, root));
+    PUT(PREDP(SUCC_FREE_BLKP(a, bp)), HEAP_OFFSET(a, bp));
+    PUT(SUCCP(root), HEAP_OFFSET(a, bp));
+    map_set(a, level);
 }
 
 /*
- Allocate memory to user according to size. First get the real size of 
- allocation by calculating aszie (adjusted block size).
+ Unlink a free block from its seglist. When the block was the only one in 
+ its level, its predecessor is the seg_header and its successor is tail,
+ so the level is marked empty. The header of the block must still hold the
+ size the block was linked with.
  */
-void *malloc (size_t size) {
-    dbg_printf("MALLOC (size: %ld)\n", size);
-
-    size_t asize;      /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    size_t tmp;
-    char *bp;      
-
-    if (heap_listp == 0){
-        mm_init();
-    }
-    /* Ignore spurious requests */
-    if (size == 0){
-        dbg_checkheap(__LINE__, 0);
-        dbg_printf("END MALLOC (size == 0)\n");
-        return NULL;
+static void list_remove(arena_t *a, void *bp) {
+    #ifndef TLSF
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+        tree_remove(a, bp);
+        if (GET(SUCCP(get_root(a, TREE_LEVEL))) == 0) {
+            map_clear(a, TREE_LEVEL);
+        }
+        return;
     }
+    #endif
+    #ifdef ADDR_ORDER
+    skip_remove(a, get_level(GET_SIZE(HDRP(bp))), bp);
+    #endif
+    char *pred = PRED_FREE_BLKP(a, bp);
+    char *succ = SUCC_FREE_BLKP(a, bp);
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= 2*FSIZE){
-        asize = 4*FSIZE;
-    }
-    else{
-        /* tmp is the number of fields needed for payload */
-        tmp = (size + (FSIZE - 1)) / FSIZE;
-        asize = (tmp & 0x1 ? (tmp + 1) : (tmp + 2)) * FSIZE;
+    PUT(SUCCP(pred), HEAP_OFFSET(a, succ));
+    PUT(PREDP(succ), HEAP_OFFSET(a, pred));
+    if (succ == a->tail && HEAP_OFFSET(a, pred) < (N_LISTS + 2)*FSIZE) {
+        map_clear(a, HEAP_OFFSET(a, pred)/FSIZE - 2);
     }
+}
 
-    /* Search the seglist list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {
-        place(bp, asize);
-        dbg_checkheap(__LINE__, 0);
-        dbg_printf("END MALLOC (find_fit succeed)\n");
-        /* debug garbled bytes */
-        #ifdef DEBUG
-        add_to_user_mm_array(bp, size);
-        #endif
-        return bp;
-    }
+/*
+ Get the first free block of a level of seglist, or tail if it is empty
+ */
+static char *level_first(arena_t *a, int level) {
+    char *bp = SUCC_FREE_BLKP(a, get_root(a, level));
 
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize,CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/FSIZE)) == NULL) { 
-        dbg_checkheap(__LINE__, 0);
-        dbg_printf("END MALLOC (extend_heap Fails)\n");
-        return NULL;
+    #ifndef TLSF
+    if (level == TREE_LEVEL && bp != a->tail) {
+        while (GET(LEFTP(bp)) != 0) {
+            bp = a->heap_startp + GET(LEFTP(bp));
+        }
     }
-    place(bp, asize);
-    dbg_checkheap(__LINE__, 0);
-    dbg_printf("END MALLOC (extend_heap)\n");
-    /* debug garbled bytes */
-    #ifdef DEBUG
-    add_to_user_mm_array(bp, size);
     #endif
     return bp;
 }
 
 /*
- Free the memory block pointed by bp.
+ Get the free block after bp in its level of seglist, or tail at the end.
+ The tree is walked in order of size.
  */
-void free(void *bp) {
-    dbg_printf("FREE\n");
-
-    if (bp == 0) {
-        return;
+static char *level_next(arena_t *a, int level, char *bp) {
+    #ifndef TLSF
+    if (level == TREE_LEVEL) {
+        bp = tree_next(a, bp);
+        return bp == NULL ? a->tail : bp;
     }
+    #else
+    (void)level;
+    #endif
+    return SUCC_FREE_BLKP(a, bp);
+}
 
-    size_t size = GET_SIZE(HDRP(bp));
+#ifdef ADDR_ORDER
+/*
+ Get the number of tiers of the skip list a free block of size bytes at bp
+ is linked into. The height is a hash of the address, so that a block is in
+ tier t with odds 1/4^t. A block of a LIFO level, below ADDR_MIN, is in no
+ tier.
+ */
+static int skip_height(const void *bp, word_t size) {
+    unsigned int h = (unsigned int)((uintptr_t)bp >> 3) * 2654435761u;
 
-    if (heap_listp == 0){
-        mm_init();
+    if (size < ADDR_MIN) {
+        return 0;
     }
+    return MIN(__builtin_clz(h | 1) / 2, SKIP_TIERS);
+}
 
-    /* debug garbled bytes */
-    #ifdef DEBUG
-    remove_from_user_mm_array(bp);
-    #endif
-    /* Change the state of this block to free */
-    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, 0, prev_alloc));
-    PUT(FTRP(bp), PACK(size, 0, prev_alloc));
+/*
+ Find in each tier of the skip list of a level the last block in front of
+ bp, NULL if there is none, and store it in update. Return the one of the
+ lowest tier.
+ */
+static char *skip_find(arena_t *a, int level, char *bp, char **update) {
+    char *x = NULL;
+    int t;
 
-    void *next_bp = NEXT_BLKP(bp);
+    for (t = SKIP_TIERS; t >= 1; t --) {
+        word_t off;
+        while ((off = GET(SKIP_FWDP(a, level, x, t))) != 0 &&
+            a->heap_startp + off < bp) {
+            x = a->heap_startp + off;
+        }
+        update[t - 1] = x;
+    }
+    return x;
+}
 
-    /* change the prev_allocated bit of next block */
-    unsigned int block_size = GET_SIZE(HDRP(next_bp));
-    unsigned int block_alloced = GET_ALLOC(HDRP(next_bp));
-    PUT(HDRP(next_bp), PACK(block_size, block_alloced, 0));
-    if (!block_alloced) {
-        /*the next block is free, so it has a footer */
-        PUT(FTRP(next_bp), PACK(block_size, block_alloced, 0));
+/*
+ Unlink a free block from the tiers of the skip list of its level
+ */
+static void skip_remove(arena_t *a, int level, char *bp) {
+    int t, height = skip_height(bp, GET_SIZE(HDRP(bp)));
+    char *update[SKIP_TIERS];
+
+    if (height == 0) {
+        return;
     }
-    coalesce(bp);
+    skip_find(a, level, bp, update);
+    for (t = 1; t <= height; t ++) {
+        PUT(SKIP_FWDP(a, level, update[t - 1], t), 
+            GET(SKIP_FWDP(a, level, bp, t)));
+    }
+}
+#endif
 
-    dbg_printf("END FREE\n");
+/*
+ Return whether node x comes before node y: smaller blocks first, and blocks
+ of the same size in address order.
+ */
+static int tree_less(char *x, char *y) {
+    word_t xsize = GET_SIZE(HDRP(x)), ysize = GET_SIZE(HDRP(y));
+    return xsize < ysize || (xsize == ysize && x < y);
 }
 
+#ifndef TLSF
 /*
- Reallocated the memory block pointed by ptr to a block of size bytes
+ The tree lives in the free blocks of the highest level. Its root is stored 
+ in the seg_header of the level, and a node holds the offsets of its left 
+ child, right child and parent where a list node holds SUCC and PRED. The 
+ offset 0 (tail) stands for no node.
  */
-void *realloc(void *ptr, size_t size) {
-    size_t oldsize;
-    void *newptr;
+static char *tree_get(arena_t *a, char *p) {
+    word_t off = GET(p);
+    return off == 0 ? NULL : a->heap_startp + off;
+}
 
-    /* If size == 0 then this is just free, and we return NULL. */
-    if(size == 0) {
-        mm_free(ptr);
-        return 0;
-    }
+static void tree_set(arena_t *a, char *p, char *bp) {
+    PUT(p, bp == NULL ? 0 : (word_t)HEAP_OFFSET(a, bp));
+}
 
-    /* If oldptr is NULL, then this is just malloc. */
-    if(ptr == NULL) {
-        return mm_malloc(size);
-    }
+#define LEFT(a, bp)    tree_get(a, LEFTP(bp))
+#define RIGHT(a, bp)   tree_get(a, RIGHTP(bp))
+#define PARENT(a, bp)  tree_get(a, PARENTP(bp))
+#define ROOTP(a)       SUCCP(get_root(a, TREE_LEVEL))
+#define IS_RED(bp)     ((bp) != NULL && GET(COLORP(bp)) == RED)
 
-    newptr = mm_malloc(size);
+/*
+ Make node y take the place of node x under the parent of x
+ */
+static void tree_replace(arena_t *a, char *x, char *y) {
+    char *p = PARENT(a, x);
 
-    /* If realloc() fails the original block is left untouched  */
-    if(!newptr) {
-        return 0;
+    if (p == NULL) {
+        tree_set(a, ROOTP(a), y);
+    } else if (LEFT(a, p) == x) {
+        tree_set(a, LEFTP(p), y);
+    } else {
+        tree_set(a, RIGHTP(p), y);
     }
+    if (y != NULL) {
+        tree_set(a, PARENTP(y), p);
+    }
+}
 
-    /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(ptr));
-    if(size < oldsize) oldsize = size;
-    memcpy(newptr, ptr, oldsize);
+static void rotate_left(arena_t *a, char *x) {
+    char *y = RIGHT(a, x);
+    char *b = LEFT(a, y);
 
-    /* Free the old block. */
-    mm_free(ptr);
+    tree_set(a, RIGHTP(x), b);
+    if (b != NULL) {
+        tree_set(a, PARENTP(b), x);
+    }
+    tree_replace(a, x, y);
+    tree_set(a, LEFTP(y), x);
+    tree_set(a, PARENTP(x), y);
+}
 
-    return newptr;
+static void rotate_right(arena_t *a, char *x) {
+    char *y = LEFT(a, x);
+    char *b = RIGHT(a, y);
+
+    tree_set(a, LEFTP(x), b);
+    if (b != NULL) {
+        tree_set(a, PARENTP(b), x);
+    }
+    tree_replace(a, x, y);
+    tree_set(a, RIGHTP(y), x);
+    tree_set(a, PARENTP(x), y);
 }
 
 /*
- malloc with content of memory initialized to zero
+ Insert a free block into the tree and restore the red-black properties
  */
-void *calloc (size_t nmemb, size_t size) {
-    size_t bytes = nmemb * size;
-    void *newptr;
+static void tree_insert(arena_t *a, char *bp) {
+    char *p = NULL, *x = tree_get(a, ROOTP(a));
+    char *g, *u;
 
-    newptr = malloc(bytes);
-    if (newptr == NULL) {
-        return NULL;
+    while (x != NULL) {
+        p = x;
+        x = tree_less(bp, x) ? LEFT(a, x) : RIGHT(a, x);
+    }
+    PUT(LEFTP(bp), 0);
+    PUT(RIGHTP(bp), 0);
+    tree_set(a, PARENTP(bp), p);
+    PUT(COLORP(bp), RED);
+    if (p == NULL) {
+        tree_set(a, ROOTP(a), bp);
+    } else if (tree_less(bp, p)) {
+        tree_set(a, LEFTP(p), bp);
+    } else {
+        tree_set(a, RIGHTP(p), bp);
     }
-    memset(newptr, 0, bytes);
 
-    return newptr;
+    /* A red node may not have a red parent */
+    x = bp;
+    while ((p = PARENT(a, x)) != NULL && IS_RED(p)) {
+        g = PARENT(a, p); /* The root is black, so p is not the root */
+        if (p == LEFT(a, g)) {
+            u = RIGHT(a, g);
+            if (IS_RED(u)) {
+                PUT(COLORP(p), BLACK);
+                PUT(COLORP(u), BLACK);
+                PUT(COLORP(g), RED);
+                x = g;
+                continue;
+            }
+            if (x == RIGHT(a, p)) {
+                rotate_left(a, p);
+                x = p;
+                p = PARENT(a, x);
+            }
+            PUT(COLORP(p), BLACK);
+            PUT(COLORP(g), RED);
+            rotate_right(a, g);
+        } else {
+            u = LEFT(a, g);
+            if (IS_RED(u)) {
+                PUT(COLORP(p), BLACK);
+                PUT(COLORP(u), BLACK);
+                PUT(COLORP(g), RED);
+                x = g;
+                continue;
+            }
+            if (x == LEFT(a, p)) {
+                rotate_right(a, p);
+                x = p;
+                p = PARENT(a, x);
+            }
+            PUT(COLORP(p), BLACK);
+            PUT(COLORP(g), RED);
+            rotate_left(a, g);
+        }
+    }
+    PUT(COLORP(tree_get(a, ROOTP(a))), BLACK);
 }
 
 /*
- Return whether the pointer is in the heap.
+ Remove a free block from the tree and restore the red-black properties
  */
-static int in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+static void tree_remove(arena_t *a, char *z) {
+    char *x, *xp, *w;
+    char *y = z;
+    unsigned int color = GET(COLORP(z));
+
+    if (LEFT(a, z) == NULL) {
+        x = RIGHT(a, z);
+        xp = PARENT(a, z);
+        tree_replace(a, z, x);
+    } else if (RIGHT(a, z) == NULL) {
+        x = LEFT(a, z);
+        xp = PARENT(a, z);
+        tree_replace(a, z, x);
+    } else {
+        /* Move the next node y into the place of z */
+        y = RIGHT(a, z);
+        while (LEFT(a, y) != NULL) {
+            y = LEFT(a, y);
+        }
+        color = GET(COLORP(y));
+        x = RIGHT(a, y);
+        if (PARENT(a, y) == z) {
+            xp = y;
+        } else {
+            xp = PARENT(a, y);
+            tree_replace(a, y, x);
+            tree_set(a, RIGHTP(y), RIGHT(a, z));
+            tree_set(a, PARENTP(RIGHT(a, y)), y);
+        }
+        tree_replace(a, z, y);
+        tree_set(a, LEFTP(y), LEFT(a, z));
+        tree_set(a, PARENTP(LEFT(a, y)), y);
+        PUT(COLORP(y), GET(COLORP(z)));
+    }
+    if (color == RED) {
+        return;
+    }
+
+    /* x, which may be no node, has one black too few on its paths */
+    while (x != tree_get(a, ROOTP(a)) && !IS_RED(x)) {
+        if (x == LEFT(a, xp)) {
+            w = RIGHT(a, xp);
+            if (IS_RED(w)) {
+                PUT(COLORP(w), BLACK);
+                PUT(COLORP(xp), RED);
+                rotate_left(a, xp);
+                w = RIGHT(a, xp);
+            }
+            if (!IS_RED(LEFT(a, w)) && !IS_RED(RIGHT(a, w))) {
+                PUT(COLORP(w), RED);
+                x = xp;
+                xp = PARENT(a, x);
+            } else {
+                if (!IS_RED(RIGHT(a, w))) {
+                    PUT(COLORP(LEFT(a, w)), BLACK);
+                    PUT(COLORP(w), RED);
+                    rotate_right(a, w);
+                    w = RIGHT(a, xp);
+                }
+                PUT(COLORP(w), GET(COLORP(xp)));
+                PUT(COLORP(xp), BLACK);
+                PUT(COLORP(RIGHT(a, w)), BLACK);
+                rotate_left(a, xp);
+                x = tree_get(a, ROOTP(a));
+            }
+        } else {
+            w = LEFT(a, xp);
+            if (IS_RED(w)) {
+                PUT(COLORP(w), BLACK);
+                PUT(COLORP(xp), RED);
+                rotate_right(a, xp);
+                w = LEFT(a, xp);
+            }
+            if (!IS_RED(LEFT(a, w)) && !IS_RED(RIGHT(a, w))) {
+                PUT(COLORP(w), RED);
+                x = xp;
+                xp = PARENT(a, x);
+            } else {
+                if (!IS_RED(LEFT(a, w))) {
+                    PUT(COLORP(RIGHT(a, w)), BLACK);
+                    PUT(COLORP(w), RED);
+                    rotate_left(a, w);
+                    w = LEFT(a, xp);
+                }
+                PUT(COLORP(w), GET(COLORP(xp)));
+                PUT(COLORP(xp), BLACK);
+                PUT(COLORP(LEFT(a, w)), BLACK);
+                rotate_right(a, xp);
+                x = tree_get(a, ROOTP(a));
+            }
+        }
+    }
+    if (x != NULL) {
+        PUT(COLORP(x), BLACK);
+    }
 }
 
 /*
- Return whether the pointer is aligned.
+ Find the smallest block in the tree that can hold asize bytes, the lowest
+ one of them if there are several
  */
-static int aligned(const void *p) {
-    return (size_t)ALIGN(p) == (size_t)p;
+static char *tree_fit(arena_t *a, size_t asize) {
+    char *x = tree_get(a, ROOTP(a));
+    char *best = NULL;
+
+    while (x != NULL) {
+        if (GET_SIZE(HDRP(x)) >= asize) {
+            best = x;
+            x = LEFT(a, x);
+        } else {
+            x = RIGHT(a, x);
+        }
+    }
+    return best;
 }
+
 /*
- Get the entrance to a level of seg_list according to asize
-*/
-static void *get_root(unsigned int asize) {
-    size_t size = (size_t)asize;
-    /* Block size falls into the highest level of seglist */
-    if (size >> (N_SEGLIST + 3)) {
-        return heap_startp + ((N_SEGLIST + 1)*FSIZE);
-    }
-    /* Mask from the bit that matters which level the block falls into */
-    size_t mask = 1 << (N_SEGLIST + 2);
-    int k = N_SEGLIST + 3;
-    for (k = N_SEGLIST + 3; k > 0; k --) {
-        if (size & mask) {
-            break;
+ Get the node after bp in the order of the tree, or NULL
+ */
+static char *tree_next(arena_t *a, char *bp) {
+    char *p;
+
+    if (RIGHT(a, bp) != NULL) {
+        bp = RIGHT(a, bp);
+        while (LEFT(a, bp) != NULL) {
+            bp = LEFT(a, bp);
         }
-        mask = mask >> 1;
+        return bp;
     }
-    if (k < 5) {
-        // the lowest level of seglist whose block size is [16, 32)
-        return heap_startp + (2*FSIZE);
+    while ((p = PARENT(a, bp)) != NULL && bp == RIGHT(a, p)) {
+        bp = p;
     }
-    return heap_startp + ((k-3)*FSIZE);
+    return p;
+}
+#endif
+
+/*
+ Clear the FTR of the block in front of bp and the HDR and link fields of bp
+ if they lie in the clean part of the heap, when bp is coalesced with the 
+ block in front of it.
+ */
+static void clean_fields(arena_t *a, void *bp) {
+    int n = LINK_FIELDS(bp, GET_SIZE(HDRP(bp)));
 
+    if (HDRP(bp) + (n + 1)*FSIZE > a->clean_lo) {
+        memset(HDRP(bp) - FSIZE, 0, (n + 2)*FSIZE);
+    }
 }
 
 /*
  If a free block has adjacent free blocks, then coalesce them together.
+ Fields between the parts that lie in the clean part of the heap are 
+ cleared as they become payload.
 */
-static void *coalesce(void *bp) 
+static void *coalesce(arena_t *a, void *bp) 
 {
     dbg_printf("COALESCE\n");
 
     size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    unsigned int size = GET_SIZE(HDRP(bp));
+    word_t size = GET_SIZE(HDRP(bp));
     
     if (prev_alloc && next_alloc) {
         /* Case 1 - no adjacent free blocks */
@@ -464,12 +4366,11 @@ static void *coalesce(void *bp)
         dbg_printf("case 2\n");
 
         void *prev_bp = PREV_BLKP(bp);
-        PUT(SUCCP(PRED_FREE_BLKP(prev_bp)), 
-            HEAP_OFFSET(SUCC_FREE_BLKP(prev_bp)));
-        PUT(PREDP(SUCC_FREE_BLKP(prev_bp)), 
-            HEAP_OFFSET(PRED_FREE_BLKP(prev_bp)));
+        list_remove(a, prev_bp);
+        STAT_ADD(a, ncoalesce, 1);
         
         size += GET_SIZE(HDRP(prev_bp));
+        clean_fields(a, bp);
         bp = prev_bp;    
         
     } else if (prev_alloc && !next_alloc) {
@@ -477,40 +4378,33 @@ static void *coalesce(void *bp)
         dbg_printf("case 3\n");
 
         void *next_bp = NEXT_BLKP(bp);
-        PUT(SUCCP(PRED_FREE_BLKP(next_bp)), 
-            HEAP_OFFSET(SUCC_FREE_BLKP(next_bp)));
-        PUT(PREDP(SUCC_FREE_BLKP(next_bp)), 
-            HEAP_OFFSET(PRED_FREE_BLKP(next_bp)));
+        list_remove(a, next_bp);
+        STAT_ADD(a, ncoalesce, 1);
 
         size += GET_SIZE(HDRP(next_bp));
+        clean_fields(a, next_bp);
     } else {
         /* Case 4 - previous block and next block are both free */
         dbg_printf("case 4\n");
 
         void *prev_bp = PREV_BLKP(bp);
         void *next_bp = NEXT_BLKP(bp);
-        PUT(SUCCP(PRED_FREE_BLKP(prev_bp)), 
-            HEAP_OFFSET(SUCC_FREE_BLKP(prev_bp)));
-        PUT(PREDP(SUCC_FREE_BLKP(prev_bp)), 
-            HEAP_OFFSET(PRED_FREE_BLKP(prev_bp)));
-        PUT(SUCCP(PRED_FREE_BLKP(next_bp)), 
-            HEAP_OFFSET(SUCC_FREE_BLKP(next_bp)));
-        PUT(PREDP(SUCC_FREE_BLKP(next_bp)), 
-            HEAP_OFFSET(PRED_FREE_BLKP(next_bp)));
+        list_remove(a, prev_bp);
+        list_remove(a, next_bp);
+        STAT_ADD(a, ncoalesce, 2);
 
         size += GET_SIZE(HDRP(prev_bp)) + GET_SIZE(HDRP(next_bp));
+        clean_fields(a, bp);
+        clean_fields(a, next_bp);
         bp = prev_bp;
     }
     PUT(HDRP(bp), PACK(size, 0, 1));
     PUT(FTRP(bp), PACK(size, 0, 1));
+    VERIFY_MERGED(a, bp, (char *)bp + size);
     /* Link the coalesced block back into seglist */
-    void *root = get_root(size);
-    PUT(SUCCP(bp), HEAP_OFFSET(SUCC_FREE_BLKP(root)));
-    PUT(PREDP(bp), HEAP_OFFSET(root));
-    PUT(PREDP(SUCC_FREE_BLKP(bp)), HEAP_OFFSET(bp));
-    PUT(SUCCP(root), HEAP_OFFSET(bp));
+    list_insert(a, bp, size);
 
-    dbg_checkheap(__LINE__, 0);
+    dbg_checkheap(a, __LINE__, 0);
     dbg_printf("END COALESCE\n");
     return bp;
 }
@@ -518,20 +4412,31 @@ static void *coalesce(void *bp)
 /* 
  Extend heap with free block and return its block pointer
  */
-static void *extend_heap(size_t words) 
+static void *extend_heap(arena_t *a, size_t words) 
 {
     dbg_printf("EXTEND_HEAP\n");
-    /* the minimum size of a block is 16 bytes (HDR, SUCC, PRED, FTR) */
+    /* the minimum size of a block is 4 fields (HDR, SUCC, PRED, FTR) */
     if (words < 4) {
         words = 4;
     }
     char *bp;
     size_t size;
+    char *zero_lo = a->zero_lo;
 
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * FSIZE : words * FSIZE;
-    if ((long)(bp = mem_sbrk(size)) == -1)  
+    /* Round up to the alignment, an even number of 4-byte words */
+    size = ALIGN(words * FSIZE);
+    if ((long)(bp = arena_sbrk(a, size)) == -1)  
         return NULL;
+    STAT_ADD(a, nextend, 1);
+
+    /* The heap above clean_lo stays clean if the new memory was never used
+    before, and otherwise only starts to be clean where it was, at zero_lo,
+    or at the new end */
+    if (zero_lo == NULL || zero_lo > a->heap_brk) {
+        a->clean_lo = a->heap_brk;
+    } else if (bp < zero_lo) {
+        a->clean_lo = zero_lo;
+    }
 
     /* Initialize free block header/footer and the epilogue header */
     unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
@@ -541,43 +4446,55 @@ static void *extend_heap(size_t words)
     char *epi = NEXT_BLKP(bp);
     PUT(HDRP(epi), PACK(0, 1, 0)); /* New epilogue header */
     /* Coalesce if the previous block was free */
-    void *rt = coalesce(bp);
+    void *rt = coalesce(a, bp);
 
     dbg_printf("END EXTEND_HEAP\n");
     return rt;
 }
 
+/*
+ Take the payload of the allocated block bp out of the clean part of the heap
+ */
+static void mark_dirty(arena_t *a, void *bp) {
+    char *end = HDRP(NEXT_BLKP(bp));
+
+    if (end > a->clean_lo) {
+        a->clean_lo = end;
+    }
+}
+
 /* 
  Place block of asize bytes at start of free block bp 
  and split if remainder would be at least minimum block size
  */
-static void place(void *bp, size_t asize)
+static void place(arena_t *a, void *bp, size_t asize)
 {
     size_t csize = GET_SIZE(HDRP(bp));   
     unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     if ((csize - asize) >= (4*FSIZE)) {
         dbg_printf("Case: (csize - asize) >= (4*FSIZE)\n");
 
+        list_remove(a, bp);
+        STAT_ADD(a, nsplit, 1);
         PUT(HDRP(bp), PACK(asize, 1, prev_alloc));
         /* The block is allocated. No footer */
-        PUT(SUCCP(PRED_FREE_BLKP(bp)), HEAP_OFFSET(SUCC_FREE_BLKP(bp)));
-        PUT(PREDP(SUCC_FREE_BLKP(bp)), HEAP_OFFSET(PRED_FREE_BLKP(bp)));
+        mark_dirty(a, bp);
         /* The splitted free block */
         bp = NEXT_BLKP(bp);
         PUT(HDRP(bp), PACK(csize-asize, 0, 1));
         PUT(FTRP(bp), PACK(csize-asize, 0, 1));
-        coalesce(bp);
+        coalesce(a, bp);
     }
     else {
         dbg_printf("Case: (csize - asize) < (4*FSIZE)\n");
 
+        list_remove(a, bp);
         PUT(HDRP(bp), PACK(csize, 1, prev_alloc));
         /* The block is allocated. No footer */
-        PUT(SUCCP(PRED_FREE_BLKP(bp)), HEAP_OFFSET(SUCC_FREE_BLKP(bp)));
-        PUT(PREDP(SUCC_FREE_BLKP(bp)), HEAP_OFFSET(PRED_FREE_BLKP(bp)));
+        mark_dirty(a, bp);
         /* Change the prev_allocated bit of next block */
         bp = NEXT_BLKP(bp);
-        unsigned int block_size = GET_SIZE(HDRP(bp));
+        word_t block_size = GET_SIZE(HDRP(bp));
         unsigned int block_alloced = GET_ALLOC(HDRP(bp));
         PUT(HDRP(bp), PACK(block_size, block_alloced, 1));
         if (!block_alloced) {
@@ -587,27 +4504,116 @@ static void place(void *bp, size_t asize)
     }
 }
 
-/* 
- Find a fit for a block with asize bytes in the seglist.
- It starts searching from the lowest possible level of seglish which contains
- block of asize. If no free block, then move to the higher level.
+#ifdef TLSF
+/* 
+ Find a fit for a block with asize bytes in constant time. The head of the 
+ lowest non-empty list at or above get_fit_level(asize) is a good fit.
+ */
+static void *find_fit(arena_t *a, size_t asize)
+{
+    int level = next_level(a, get_fit_level(asize));
+    if (level < 0) {
+        return NULL; /* No fit */
+    }
+    return SUCC_FREE_BLKP(a, get_root(a, level));
+}
+
+/*
+ The head of a TLSF list is taken without comparing blocks, so the depth 
+ is always 1.
+ */
+int mm_set_fit_depth(int depth) {
+    (void)depth;
+    return 1;
+}
+#else
+/* 
+ Find a fit for a block with asize bytes in the seglist.
+ It first searches the level of seglist which contains block of asize. 
+ Every block in a higher level fits, so a miss there is answered by the 
+ lowest non-empty higher level, found with find-first-set on seg_map.
+ */
+
+static void *find_fit(arena_t *a, size_t asize)
+{
+    int level = get_level(asize);
+    void *bp;
+
+    /* Search in the level of seglist of asize */
+    if ((bp = good_fit(a, level, asize)) != NULL) {
+        return bp;
+    }
+    /* Move to the lowest non-empty higher level */
+    if ((level = next_level(a, level + 1)) < 0) {
+        return NULL; /* No fit */
+    }
+    return good_fit(a, level, asize);
+}
+
+/*
+ Find the smallest block of one level of seglist among the first fit_depth 
+ blocks that can hold asize bytes. An exact fit ends the search at once.
+ The tree of the highest level gives the best fit.
+ */
+static void *good_fit(arena_t *a, int level, size_t asize)
+{
+    void *bp = SUCC_FREE_BLKP(a, get_root(a, level));
+    void *best = NULL;
+    size_t best_size = 0;
+    int n = fit_depth;
+
+    if (level == TREE_LEVEL) {
+        return tree_fit(a, asize); /* Best fit at any depth */
+    }
+    while (bp != a->tail) {
+        size_t size = GET_SIZE(HDRP(bp));
+        if (size >= asize) {
+            if (size == asize) {
+                return bp;
+            }
+            if (best == NULL || size < best_size) {
+                best = bp;
+                best_size = size;
+            }
+            if (-- n == 0) {
+                break;
+            }
+        }
+        bp = SUCC_FREE_BLKP(a, bp);
+    }
+    return best;
+}
+
+/*
+ Set the number of fitting blocks find_fit() compares in a level of seglist,
+ 1 being first fit. Return the previous depth.
  */
+int mm_set_fit_depth(int depth) {
+    int old = fit_depth;
 
-static void *find_fit(size_t asize)
+    fit_depth = MAX(depth, 1);
+    return old;
+}
+#endif
+
+/*
+ Find a free block in the seglist that can hold a block of asize bytes whose
+ block ptr is a multiple of align, with first-fit over the non-empty levels.
+ */
+static void *find_fit_aligned(arena_t *a, size_t align, size_t asize)
 {
-    /* First-fit search */
-    char *root = get_root(asize);
-    while (root != (heap_startp + ((N_SEGLIST + 2)*FSIZE))) {
-        /* Search in a level of seglist */
-        void *bp = SUCC_FREE_BLKP(root);
-        while (bp != tail) {
-            if (GET_SIZE(HDRP(bp)) >= asize) {
+    int level = next_level(a, get_level(asize));
+
+    while (level >= 0) {
+        char *bp = level_first(a, level);
+        while (bp != a->tail) {
+            if (align_bp(bp, align) + asize <= 
+                (char *)bp + GET_SIZE(HDRP(bp))) {
                 return bp;
             }
-            bp = SUCC_FREE_BLKP(bp);
+            bp = level_next(a, level, bp);
         }
-        /* Move to the higher level */
-        root = root + FSIZE;
+        level = next_level(a, level + 1);
     }
     return NULL; /* No fit */
 }
@@ -638,10 +4644,10 @@ static void printblock(void *bp)
     } else {
         /* Free block with footer */
         printf("%p: header: [%ld:%ld:%ld] footer: [%ld:%ld:%ld] \
-         PRED: %x, SUCC: %x\n",
+         PRED: %zx, SUCC: %zx\n",
             bp,
             hsize, halloc, hprevalloc, fsize, falloc, fprevalloc,
-            GET(PREDP(bp)), GET(SUCCP(bp)));
+            (size_t)GET(PREDP(bp)), (size_t)GET(SUCCP(bp)));
     }
 }
 
@@ -649,13 +4655,22 @@ static void printblock(void *bp)
  Heapcheck function that will be automatically called in driver with -d.
  */
 void mm_checkheap(int lineno) {
-    checkheap(lineno, 1);
+    int i;
+
+    for (i = 0; i < n_arenas; i ++) {
+        arena_t *a = &arenas[i];
+        LOCK_ARENA(a);
+        if (a->heap_listp != 0) {
+            checkheap(a, lineno, 1);
+        }
+        UNLOCK_ARENA(a);
+    }
 }
 
 /*
  Real implementation of heapcheck function
  */
-void checkheap(int lineno, int verbose) {
+void checkheap(arena_t *a, int lineno, int verbose) {
     if (verbose){
         if (lineno == 1) {
             /* Called by driver */
@@ -668,45 +4683,47 @@ void checkheap(int lineno, int verbose) {
 
     /* Check prologue block */
     if (verbose) {
-        printf("Heap (%p):\n", heap_listp);
+        printf("Heap (%p):\n", a->heap_listp);
     }
     /* Check alignment and allocation bit */
-    if ((GET_SIZE(HDRP(heap_listp))!=2*FSIZE)||!GET_ALLOC(HDRP(heap_listp))){   
+    if (GET_SIZE(HDRP(a->heap_listp)) != 2*FSIZE ||
+        !GET_ALLOC(HDRP(a->heap_listp))) {
         printf("(%d) Bad prologue header\n", lineno);
     }
     /* Check matching of header and footer */
-    if (GET(HDRP(heap_listp)) != GET(FTRP(heap_listp))) { 
+    if (GET(HDRP(a->heap_listp)) != GET(FTRP(a->heap_listp))) { 
         printf("(%d) Bad prologue header does not match footer\n\n", lineno);
     }
     /* Check heap boundary */
-    if (!in_heap(heap_listp)) {
+    if (!in_heap(a, a->heap_listp)) {
         printf("(%d) Outside heap boundary\n", lineno);
     }
     size_t hsize, halloc, hprevalloc, fsize, falloc, fprevalloc;
-    hsize = GET_SIZE(HDRP(heap_listp));
-    halloc = GET_ALLOC(HDRP(heap_listp));
-    hprevalloc = GET_PREV_ALLOC(HDRP(heap_listp));
-    fsize = GET_SIZE(FTRP(heap_listp));
-    falloc = GET_ALLOC(FTRP(heap_listp));
-    fprevalloc = GET_PREV_ALLOC(FTRP(heap_listp));
+    hsize = GET_SIZE(HDRP(a->heap_listp));
+    halloc = GET_ALLOC(HDRP(a->heap_listp));
+    hprevalloc = GET_PREV_ALLOC(HDRP(a->heap_listp));
+    fsize = GET_SIZE(FTRP(a->heap_listp));
+    falloc = GET_ALLOC(FTRP(a->heap_listp));
+    fprevalloc = GET_PREV_ALLOC(FTRP(a->heap_listp));
     printf("%p: header: [%ld:%ld:%ld] footer: [%ld:%ld:%ld]\n",
-            heap_listp,
+            a->heap_listp,
             hsize, halloc, hprevalloc,
             fsize, falloc, fprevalloc);
 
     size_t free_blocks = 0; // number of free blocks in heap
     size_t prev_alloc = 1;
     char *bp;
-    for (bp=NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp=NEXT_BLKP(bp)) {
+    for (bp = NEXT_BLKP(a->heap_listp); GET_SIZE(HDRP(bp)) > 0;
+        bp = NEXT_BLKP(bp)) {
         if (verbose) {
             printblock(bp);
         }
-        checkblock(bp, lineno);
+        checkblock(a, bp, lineno);
         /* Check previous allocate bit consistency */
         if (GET_PREV_ALLOC(HDRP(bp)) != prev_alloc) {
             printf("(%d) Error: %p prev_alloc bit: %d, \
                 alloc_bit of prev blk: %zu\n", 
-                lineno, bp, GET_PREV_ALLOC(HDRP(bp)), prev_alloc);
+                lineno, bp, (int)GET_PREV_ALLOC(HDRP(bp)), prev_alloc);
         }
         /* Check coalescing: whether consecutive free blocks exist */
         if (prev_alloc == 0 && GET_ALLOC(HDRP(bp)) == 0) {
@@ -727,7 +4744,7 @@ void checkheap(int lineno, int verbose) {
     if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
         printf("(%d) Bad epilogue header\n", lineno);
     /* Check the segregated list */
-    size_t free_blocks_in_list = check_list(lineno, verbose);
+    size_t free_blocks_in_list = check_list(a, lineno, verbose);
     /* The number of free blocks in heap and in seglist do not match */
     if (free_blocks != free_blocks_in_list) {
         printf(
@@ -736,20 +4753,27 @@ void checkheap(int lineno, int verbose) {
     }
 
     /* Check heap boundary */
-    if (!in_heap(bp)) {
+    if (!in_heap(a, bp)) {
         printf("(%d) Outside heap boundary\n", lineno);
     }
+
+    #ifndef NO_SLAB
+    check_slabs(a, lineno, verbose);
+    #endif
+    #ifndef NO_QUICK
+    check_quick(a, lineno);
+    #endif
 }
 
 /* Check a specific block */
-static void checkblock(void *bp, int lineno) 
+static void checkblock(arena_t *a, void *bp, int lineno) 
 {
     /* Check block's alignment */
     if (!aligned(bp)) {
         printf("(%d) Error: %p is not doubleword aligned\n", lineno, bp);
     }
     /* Check minimum size of a block */
-    if ((bp != heap_listp) && GET_SIZE(HDRP(bp)) < 4 * FSIZE) {
+    if ((bp != a->heap_listp) && GET_SIZE(HDRP(bp)) < 4 * FSIZE) {
         printf("(%d) Error: %p block size is smaller than minimum size\n", 
             lineno, bp);
     }
@@ -759,6 +4783,17 @@ static void checkblock(void *bp, int lineno)
         if (GET(HDRP(bp)) != GET(FTRP(bp))){
             printf("(%d) Error: header does not match footer\n", lineno);
         }
+        /* Check that the payload in the clean part of the heap is zero */
+        char *p = MAX((char *)bp + LINK_FIELDS(bp, GET_SIZE(HDRP(bp)))*FSIZE, 
+            a->clean_lo);
+        for (; p < FTRP(bp); p ++) {
+            if (*p != 0) {
+                printf("(%d) Error: %p is not clean at %p\n", lineno, bp, p);
+                break;
+            }
+        }
+    } else if (NEXT_BLKP(bp) - FSIZE > a->clean_lo) {
+        printf("(%d) Error: allocated %p in the clean part\n", lineno, bp);
     }
 }
 
@@ -766,7 +4801,7 @@ static void checkblock(void *bp, int lineno)
  Check the free list (segregated list)
  Return the number of free blocks in seglist.
  */
-static size_t check_list(int lineno, int verbose) {
+static size_t check_list(arena_t *a, int lineno, int verbose) {
     if (verbose) {
         printf("(%d) Segregated list:\n", lineno);
     }
@@ -774,14 +4809,37 @@ static size_t check_list(int lineno, int verbose) {
     size_t free_blocks_in_list = 0;
     
     int i = 0;
-    for (i = 0; i < N_SEGLIST; i ++) {
+    for (i = 0; i < N_LISTS; i ++) {
         /* Check a specific level of seglist */
-        void *root = heap_startp + ((i + 2)*FSIZE);
-        unsigned int level_size = (1 << (4+i));
-        printf("root (size %u): %p\n", level_size, root);
+        void *root = get_root(a, i);
+        if (verbose) {
+            printf("root (level %d): %p\n", i, root);
+        }
+        /* Check the non-empty bit of the level */
+        if (map_test(a, i) != (SUCC_FREE_BLKP(a, root) != a->tail)) {
+            printf("(%d) Error: wrong seg_map bit of level %d\n", lineno, i);
+        }
 
-        void *ptr = SUCC_FREE_BLKP(root);
-        while (ptr != tail) {
+        int is_list = 1;
+        #ifdef ADDR_ORDER
+        if (i != TREE_LEVEL) {
+            check_skip(a, i, lineno);
+        }
+        #endif
+        #ifndef TLSF
+        if (i == TREE_LEVEL) {
+            /* Check the links and colors of the tree */
+            char *top = tree_get(a, ROOTP(a));
+            if (IS_RED(top) || (top != NULL && PARENT(a, top) != NULL)) {
+                printf("(%d) Error: bad tree root %p\n", lineno, top);
+            }
+            check_tree(a, top, lineno);
+            is_list = 0;
+        }
+        #endif
+        void *prev = NULL;
+        void *ptr = level_first(a, i);
+        while (ptr != a->tail) {
             /* Cound free blocks in seglist */
             free_blocks_in_list ++;
             if (verbose) {
@@ -790,39 +4848,716 @@ static size_t check_list(int lineno, int verbose) {
             /* Check whether the block is outside the heap boundary,
             whether list pointers points between mem_heap_lo and_mem heap_high
             */
-            if (!in_heap(ptr)) {
+            if (!in_heap(a, ptr)) {
                 printf("(%d) %p out of heap\n", lineno, ptr);
             }
             /* Check the consistency of pointers */
-            if (SUCC_FREE_BLKP(PRED_FREE_BLKP(ptr)) != ptr) {
+            if (is_list && SUCC_FREE_BLKP(a, PRED_FREE_BLKP(a, ptr)) != ptr) {
                 printf("(%d) %p inconsistent ptr->pred->succ\n", lineno, ptr);
             }
             /* Check the consistency of pointers */
-            if ((SUCC_FREE_BLKP(ptr) != tail) && 
-                PRED_FREE_BLKP(SUCC_FREE_BLKP(ptr)) != ptr) {
+            if (is_list && (SUCC_FREE_BLKP(a, ptr) != a->tail) && 
+                PRED_FREE_BLKP(a, SUCC_FREE_BLKP(a, ptr)) != ptr) {
                 printf("(%d) %p inconsistent ptr->succ->pred\n", lineno, ptr);
             }
+            /* Check the order of the tree */
+            if (!is_list && prev != NULL && !tree_less(prev, ptr)) {
+                printf("(%d) %p out of order after %p\n", lineno, ptr, prev);
+            }
+            #ifdef ADDR_ORDER
+            /* Check the order of the list */
+            if (is_list && prev != NULL && (char *)prev >= (char *)ptr &&
+                GET_SIZE(HDRP(ptr)) >= ADDR_MIN) {
+                printf("(%d) %p out of order after %p\n", lineno, ptr, prev);
+            }
+            #endif
             /* Check whether a blocks falls into the right level of seglist */
-            unsigned int block_size = GET_SIZE(HDRP(ptr));
-            if (i != N_SEGLIST - 1) { // not the higest level, has upper bound
-                if (block_size < level_size || block_size >= 2 * level_size) {
-                    printf("(%d) %p with size of %u in the wrong list %u\n", 
-                        lineno, ptr, block_size, level_size);
-                }
-            } else { // highest level, no upper bound for block size
-                if (block_size < level_size) {
-                    printf("(%d) %p with size of %u in the wrong list %u\n", 
-                        lineno, ptr, block_size, level_size);
-                }
+            word_t block_size = GET_SIZE(HDRP(ptr));
+            if (get_level(block_size) != i) {
+                printf("(%d) %p with size of %zu in the wrong list %d\n",
+                    lineno, ptr, (size_t)block_size, i);
             }
-            ptr = SUCC_FREE_BLKP(ptr);
+            prev = ptr;
+            ptr = level_next(a, i, ptr);
         }
     }
 
     if (verbose) { // Tail sentinel
-        printf("all tail: %p, pred: %p\n", tail, PRED_FREE_BLKP(tail));
+        printf("all tail: %p, pred: %p\n", a->tail, PRED_FREE_BLKP(a, a->tail));
         printf("(%d) END check list\n", lineno);
     }
 
     return free_blocks_in_list;
 }
+
+#ifndef TLSF
+/*
+ Check the parent links and colors of the subtree at bp. 
+ Return the number of black nodes on each path down from bp.
+ */
+static int check_tree(arena_t *a, char *bp, int lineno) {
+    char *child[2];
+    int height[2], i;
+
+    if (bp == NULL) {
+        return 1;
+    }
+    child[0] = LEFT(a, bp);
+    child[1] = RIGHT(a, bp);
+    for (i = 0; i < 2; i ++) {
+        if (child[i] != NULL && PARENT(a, child[i]) != bp) {
+            printf("(%d) %p inconsistent ptr->child->parent\n", lineno, bp);
+        }
+        if (IS_RED(bp) && IS_RED(child[i])) {
+            printf("(%d) Error: red %p has a red child\n", lineno, bp);
+        }
+        height[i] = check_tree(a, child[i], lineno);
+    }
+    if (height[0] != height[1]) {
+        printf("(%d) Error: unbalanced tree at %p\n", lineno, bp);
+    }
+    return height[0] + !IS_RED(bp);
+}
+#endif
+
+#ifdef ADDR_ORDER
+/*
+ Check that each tier of the skip list of a level links, in address order,
+ exactly the blocks of the level that are tall enough.
+ */
+static void check_skip(arena_t *a, int level, int lineno) {
+    int t;
+
+    for (t = 1; t <= SKIP_TIERS; t ++) {
+        char *bp = level_first(a, level);
+        char *x = NULL;
+        for (; bp != a->tail; bp = level_next(a, level, bp)) {
+            if (skip_height(bp, GET_SIZE(HDRP(bp))) < t) {
+                continue;
+            }
+            word_t off = GET(SKIP_FWDP(a, level, x, t));
+            if (a->heap_startp + off != bp) {
+                printf("(%d) %p missing in tier %d of level %d\n", 
+                    lineno, bp, t, level);
+                return;
+            }
+            x = bp;
+        }
+        if (GET(SKIP_FWDP(a, level, x, t)) != 0) {
+            printf("(%d) Error: tier %d of level %d does not end\n", 
+                lineno, t, level);
+        }
+    }
+}
+#endif
+
+#ifndef NO_QUICK
+/*
+ Check that the quick lists of an arena hold allocated blocks of their 
+ size, and as many bytes as counted.
+ */
+static void check_quick(arena_t *a, int lineno) {
+    size_t bytes = 0;
+    int i;
+
+    for (i = 0; i < QUICK_NBINS; i ++) {
+        void *bp;
+        for (bp = a->quick[i]; bp != NULL; bp = QUICK_NEXT(bp)) {
+            if (!in_heap(a, bp) || !GET_ALLOC(HDRP(bp)) ||
+                GET_SIZE(HDRP(bp)) != (word_t)(i + 2) * ALIGNMENT) {
+                printf("(%d) Error: bad block %p in quick list %d\n", 
+                    lineno, bp, i);
+                break;
+            }
+            bytes += GET_SIZE(HDRP(bp));
+        }
+    }
+    if (bytes != a->quick_bytes) {
+        printf("(%d) Error: quick lists hold %zu bytes, counted %zu\n", 
+            lineno, bytes, a->quick_bytes);
+    }
+}
+#endif
+
+#ifndef NO_SLAB
+/*
+ Check the partial runs of every slab class of an arena.
+ */
+static void check_slabs(arena_t *a, int lineno, int verbose) {
+    int cls, i;
+
+    for (cls = 0; cls < SLAB_NCLASSES; cls ++) {
+        slab_run_t *prev = NULL;
+        slab_run_t *run;
+        for (run = a->slab_partial[cls]; run != NULL; run = run->next) {
+            int nfree = 0;
+            if (verbose) {
+                printf("%p: run of %d-byte slots, %d/%d free\n", run, 
+                    SLAB_SLOT_SIZE(cls), run->nfree, run->nslots);
+            }
+            /* The run is the page aligned payload of an allocated block */
+            if (!in_heap(a, run) || (uintptr_t)run % SLAB_RUN != 0 ||
+                !GET_ALLOC(HDRP(run))) {
+                printf("(%d) Error: %p bad slab run\n", lineno, run);
+            }
+            if (pagemap_get(run) != cls + 1 || run->cls != cls) {
+                printf("(%d) Error: %p run in the wrong class %d\n", 
+                    lineno, run, cls);
+            }
+            if (run->prev != prev) {
+                printf("(%d) %p inconsistent run->prev\n", lineno, run);
+            }
+            for (i = 0; i < SLAB_MAP_WORDS; i ++) {
+                nfree += __builtin_popcountll(run->map[i]);
+            }
+            if (nfree != run->nfree || nfree == 0) {
+                printf("(%d) Error: %p run has %d free slots, counted %d\n",
+                    lineno, run, run->nfree, nfree);
+            }
+            prev = run;
+        }
+    }
+}
+#endif
+
+/*
+ Errors found by mm_verify_step() and mm_verify(). Threads of mm_verify()
+ add to one sink at once, each error taking a slot of its own.
+ */
+typedef struct verify_sink {
+    struct mm_verify_error *errs;
+    int max;
+    int n;                  /* Errors found, some maybe not stored */
+} verify_sink_t;
+
+static void verify_error(verify_sink_t *s, int code, arena_t *a, int level,
+    void *bp, void *other) {
+    int i = __atomic_fetch_add(&s->n, 1, __ATOMIC_RELAXED);
+
+    if (i < s->max) {
+        s->errs[i].code = code;
+        s->errs[i].arena = (int)(a - arenas);
+        s->errs[i].level = level;
+        s->errs[i].block = bp;
+        s->errs[i].other = other;
+    }
+}
+
+static void verify_prologue(arena_t *a, verify_sink_t *s) {
+    char *bp = a->heap_listp;
+
+    if (GET_SIZE(HDRP(bp)) != 2*FSIZE || !GET_ALLOC(HDRP(bp)) ||
+        GET(HDRP(bp)) != GET(FTRP(bp))) {
+        verify_error(s, MM_VERIFY_PROLOGUE, a, -1, bp, NULL);
+    }
+}
+
+/*
+ Check the block at bp, of which the block in front is allocated if 
+ prev_alloc is set. Free blocks in the clean part of the heap are scanned 
+ for dirty bytes only if full is set. Return 0 if the size of the block is
+ bad, so the next block cannot be found.
+ */
+static int verify_block(arena_t *a, char *bp, int prev_alloc, int full, 
+    verify_sink_t *s) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (!aligned(bp)) {
+        verify_error(s, MM_VERIFY_ALIGN, a, -1, bp, NULL);
+        return 0;
+    }
+    if (size < 4*FSIZE || size > (size_t)(a->heap_brk - bp)) {
+        verify_error(s, MM_VERIFY_SIZE, a, -1, bp, NULL);
+        return 0;
+    }
+    if ((int)GET_PREV_ALLOC(HDRP(bp)) != prev_alloc) {
+        verify_error(s, MM_VERIFY_PREV_ALLOC, a, -1, bp, NULL);
+    }
+    if (GET_ALLOC(HDRP(bp))) {
+        if (NEXT_BLKP(bp) - FSIZE > a->clean_lo) {
+            verify_error(s, MM_VERIFY_CLEAN, a, -1, bp, NULL);
+        }
+        return 1;
+    }
+    if (!prev_alloc) {
+        verify_error(s, MM_VERIFY_COALESCE, a, -1, bp, NULL);
+    }
+    if (GET(HDRP(bp)) != GET(FTRP(bp))) {
+        verify_error(s, MM_VERIFY_FOOTER, a, -1, bp, NULL);
+    }
+    if (full) {
+        char *p = MAX(bp + LINK_FIELDS(bp, size)*FSIZE, a->clean_lo);
+        for (; p < FTRP(bp); p ++) {
+            if (*p != 0) {
+                verify_error(s, MM_VERIFY_CLEAN, a, -1, bp, p);
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ Check the end of the blocks of a heap at bp
+ */
+static void verify_epilogue(arena_t *a, char *bp, verify_sink_t *s) {
+    if (!GET_ALLOC(HDRP(bp)) || bp != a->heap_brk) {
+        verify_error(s, MM_VERIFY_EPILOGUE, a, -1, bp, NULL);
+    }
+}
+
+/*
+ Check the free block at bp, which follows prev (NULL at the head) in a 
+ seglist level. Return 0 if bp is not a free block, so the walk must stop.
+ */
+static int verify_link(arena_t *a, int level, char *prev, char *bp, 
+    verify_sink_t *s) {
+    int is_list = 1;
+
+    #ifndef TLSF
+    is_list = level != TREE_LEVEL;
+    #endif
+    if (!in_heap(a, bp) || !aligned(bp) || GET_ALLOC(HDRP(bp))) {
+        verify_error(s, MM_VERIFY_LINK, a, level, bp, prev);
+        return 0;
+    }
+    if (get_level(GET_SIZE(HDRP(bp))) != level) {
+        verify_error(s, MM_VERIFY_LEVEL, a, level, bp, NULL);
+    }
+    if (is_list) {
+        char *succ = SUCC_FREE_BLKP(a, bp);
+        if (SUCC_FREE_BLKP(a, PRED_FREE_BLKP(a, bp)) != bp) {
+            verify_error(s, MM_VERIFY_LINK, a, level, bp, 
+                PRED_FREE_BLKP(a, bp));
+        }
+        if (succ != a->tail && (!in_heap(a, succ) || 
+            PRED_FREE_BLKP(a, succ) != bp)) {
+            verify_error(s, MM_VERIFY_LINK, a, level, bp, succ);
+            return 0;
+        }
+    }
+    #ifdef ADDR_ORDER
+    if (is_list && prev != NULL && prev >= bp &&
+        GET_SIZE(HDRP(bp)) >= ADDR_MIN) {
+        verify_error(s, MM_VERIFY_ORDER, a, level, bp, prev);
+    }
+    #endif
+    #ifndef TLSF
+    if (!is_list && prev != NULL && !tree_less(prev, bp)) {
+        verify_error(s, MM_VERIFY_ORDER, a, level, bp, prev);
+    }
+    #endif
+    return 1;
+}
+
+static void verify_map(arena_t *a, int level, verify_sink_t *s) {
+    if (map_test(a, level) != (SUCC_FREE_BLKP(a, get_root(a, level)) != 
+        a->tail)) {
+        verify_error(s, MM_VERIFY_MAP, a, level, NULL, NULL);
+    }
+}
+
+/*
+ Check the next budget blocks and budget free blocks of one level of a, 
+ and move its cursors. Called with the arena lock held.
+ */
+static void verify_step(arena_t *a, size_t budget, verify_sink_t *s) {
+    char *bp = a->verify_at;
+    char *link = a->verify_link;
+    int level = a->verify_level;
+    size_t n;
+
+    if (bp == NULL || GET_SIZE(HDRP(bp)) == 0) {
+        /* Start over; a cursor on the epilogue was cut off by mm_trim() */
+        verify_prologue(a, s);
+        bp = a->heap_listp;
+    }
+    for (n = 0; n < budget; n ++) {
+        char *next = NEXT_BLKP(bp);
+        if (GET_SIZE(HDRP(next)) == 0) {
+            verify_epilogue(a, next, s);
+            bp = NULL;
+            break;
+        }
+        if (!verify_block(a, next, GET_ALLOC(HDRP(bp)) != 0, 0, s)) {
+            /* Start over, and find it again, after the next call */
+            bp = NULL;
+            break;
+        }
+        bp = next;
+    }
+    a->verify_at = bp;
+
+    /* The last free block checked is still a place to resume from if it
+    is still free and in the level, as VERIFY_MERGED() drops it when it is
+    merged into a block in front */
+    if (link != NULL && (!in_heap(a, link) || !aligned(link) || 
+        GET_ALLOC(HDRP(link)) || get_level(GET_SIZE(HDRP(link))) != level)) {
+        link = NULL;
+    }
+    if (link == NULL) {
+        verify_map(a, level, s);
+    }
+    for (n = 0; n < budget; n ++) {
+        char *next = link == NULL ? level_first(a, level) : 
+            level_next(a, level, link);
+        if (next == a->tail || !verify_link(a, level, link, next, s)) {
+            link = NULL;
+            level = (level + 1) % N_LISTS;
+            break;
+        }
+        link = next;
+    }
+    a->verify_link = link;
+    a->verify_level = level;
+}
+
+int mm_verify_step(size_t budget, struct mm_verify_error *errs, int max) {
+    static int next_arena = 0;  /* Arena the next call checks */
+    verify_sink_t s = {errs, max, 0};
+    int n = __atomic_load_n(&n_arenas, __ATOMIC_ACQUIRE);
+    int i;
+
+    /* The next arena with a heap */
+    for (i = 0; i < n; i ++) {
+        arena_t *a = &arenas[__atomic_fetch_add(&next_arena, 1, 
+            __ATOMIC_RELAXED) % n];
+        LOCK_ARENA(a);
+        if (a->heap_listp != 0) {
+            verify_step(a, budget, &s);
+            UNLOCK_ARENA(a);
+            break;
+        }
+        UNLOCK_ARENA(a);
+    }
+    return s.n;
+}
+
+#ifndef TLSF
+/*
+ Check the parent links and colors of the subtree at bp, depth nodes below
+ the root. Return the number of black nodes on each path down from bp.
+ */
+static int verify_tree(arena_t *a, char *bp, int depth, verify_sink_t *s) {
+    char *child[2];
+    int height[2], i;
+
+    if (bp == NULL) {
+        return 1;
+    }
+    if (!in_heap(a, bp) || depth > 2*8*FSIZE) {
+        /* Out of the heap, or a loop */
+        verify_error(s, MM_VERIFY_LINK, a, TREE_LEVEL, bp, NULL);
+        return 0;
+    }
+    child[0] = LEFT(a, bp);
+    child[1] = RIGHT(a, bp);
+    for (i = 0; i < 2; i ++) {
+        if (child[i] != NULL && (!in_heap(a, child[i]) || 
+            PARENT(a, child[i]) != bp)) {
+            verify_error(s, MM_VERIFY_LINK, a, TREE_LEVEL, child[i], bp);
+            return 0;
+        }
+        if (IS_RED(bp) && IS_RED(child[i])) {
+            verify_error(s, MM_VERIFY_ORDER, a, TREE_LEVEL, child[i], bp);
+        }
+        height[i] = verify_tree(a, child[i], depth + 1, s);
+    }
+    if (height[0] != height[1]) {
+        verify_error(s, MM_VERIFY_ORDER, a, TREE_LEVEL, bp, NULL);
+    }
+    return height[0] + !IS_RED(bp);
+}
+#endif
+
+#define VERIFY_PIECES 256  /* Most pieces a heap is cut into */
+#define VERIFY_STRIDE 64   /* Fewest blocks in a piece */
+
+/*
+ The check of one heap by mm_verify(). The tasks are the seglist levels and
+ then the pieces of the heap, taken in turn by every thread. A level cannot
+ be cut, so the long walks of the lists start first.
+ */
+typedef struct verify_job {
+    arena_t *a;
+    verify_sink_t *sink;
+    char *piece[VERIFY_PIECES + 1];   /* First block of each piece, and the
+                                         block the walk stopped at */
+    unsigned char prev_alloc[VERIFY_PIECES + 1]; /* Of the block in front */
+    int npieces;
+    int ntasks;
+    int next;                /* Next task to take */
+    size_t heap_free;        /* Free blocks in the pieces */
+    size_t list_free;        /* Free blocks in the seglist */
+} verify_job_t;
+
+/*
+ Cut the heap of the job into pieces at every stride blocks, doubling the 
+ stride whenever the pieces run out. Only the sizes in the headers are read:
+ the walk stops at a size that would leave the heap.
+ */
+static void verify_cut(verify_job_t *job) {
+    arena_t *a = job->a;
+    char *bp = NEXT_BLKP(a->heap_listp);
+    size_t stride = VERIFY_STRIDE, n = 0;
+    int prev_alloc = 1, i;
+
+    job->npieces = 0;
+    while (GET_SIZE(HDRP(bp)) != 0) {
+        size_t size = GET_SIZE(HDRP(bp));
+        if (n % stride == 0) {
+            if (job->npieces == VERIFY_PIECES) {
+                /* Keep every other piece */
+                for (i = 0; i < VERIFY_PIECES / 2; i ++) {
+                    job->piece[i] = job->piece[2*i];
+                    job->prev_alloc[i] = job->prev_alloc[2*i];
+                }
+                job->npieces = VERIFY_PIECES / 2;
+                stride *= 2;
+            }
+            if (n % stride == 0) {
+                job->piece[job->npieces] = bp;
+                job->prev_alloc[job->npieces ++] = prev_alloc;
+            }
+        }
+        if (!aligned(bp) || size < 4*FSIZE || 
+            size > (size_t)(a->heap_brk - bp)) {
+            break;
+        }
+        prev_alloc = GET_ALLOC(HDRP(bp)) != 0;
+        bp += size;
+        n ++;
+    }
+    job->piece[job->npieces] = bp;
+    job->prev_alloc[job->npieces] = prev_alloc;
+    job->ntasks = job->npieces + N_LISTS;
+    job->next = 0;
+    job->heap_free = job->list_free = 0;
+}
+
+/*
+ Take tasks of the job until there are none left
+ */
+static void verify_run(verify_job_t *job) {
+    arena_t *a = job->a;
+    verify_sink_t *s = job->sink;
+    int t;
+
+    while ((t = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < 
+        job->ntasks) {
+        size_t nfree = 0;
+
+        if (t >= N_LISTS) {
+            char *bp = job->piece[t - N_LISTS];
+            int prev_alloc = job->prev_alloc[t - N_LISTS];
+            for (; bp < job->piece[t - N_LISTS + 1]; bp = NEXT_BLKP(bp)) {
+                if (!verify_block(a, bp, prev_alloc, 1, s)) {
+                    break;
+                }
+                prev_alloc = GET_ALLOC(HDRP(bp)) != 0;
+                nfree += !prev_alloc;
+            }
+            __atomic_fetch_add(&job->heap_free, nfree, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        /* A level can hold no more blocks than fit in the heap */
+        int level = t;
+        size_t limit = (a->heap_brk - a->heap_startp) / (4*FSIZE);
+        char *prev = NULL, *bp;
+        verify_map(a, level, s);
+        #ifndef TLSF
+        if (level == TREE_LEVEL) {
+            char *top = tree_get(a, ROOTP(a));
+            if (IS_RED(top) || (top != NULL && in_heap(a, top) && 
+                PARENT(a, top) != NULL)) {
+                verify_error(s, MM_VERIFY_LINK, a, level, top, NULL);
+            }
+            verify_tree(a, top, 0, s);
+        }
+        #endif
+        for (bp = level_first(a, level); bp != a->tail; 
+            bp = level_next(a, level, bp)) {
+            if (nfree ++ == limit) {
+                verify_error(s, MM_VERIFY_LINK, a, level, bp, prev);
+                break;
+            }
+            if (!verify_link(a, level, prev, bp, s)) {
+                break;
+            }
+            prev = bp;
+        }
+        __atomic_fetch_add(&job->list_free, nfree, __ATOMIC_RELAXED);
+    }
+}
+
+#ifndef NO_QUICK
+static void verify_quick(arena_t *a, verify_sink_t *s) {
+    size_t bytes = 0;
+    int i;
+
+    for (i = 0; i < QUICK_NBINS; i ++) {
+        void *bp;
+        for (bp = a->quick[i]; bp != NULL; bp = QUICK_NEXT(bp)) {
+            if (!in_heap(a, bp) || !GET_ALLOC(HDRP(bp)) ||
+                GET_SIZE(HDRP(bp)) != (word_t)(i + 2) * ALIGNMENT) {
+                verify_error(s, MM_VERIFY_QUICK, a, -1, bp, NULL);
+                break;
+            }
+            bytes += GET_SIZE(HDRP(bp));
+        }
+    }
+    if (bytes != a->quick_bytes) {
+        verify_error(s, MM_VERIFY_QUICK, a, -1, NULL, NULL);
+    }
+}
+#endif
+
+#ifndef NO_SLAB
+static void verify_slabs(arena_t *a, verify_sink_t *s) {
+    int cls, i;
+
+    for (cls = 0; cls < SLAB_NCLASSES; cls ++) {
+        slab_run_t *prev = NULL;
+        slab_run_t *run;
+        for (run = a->slab_partial[cls]; run != NULL; run = run->next) {
+            int nfree = 0;
+            if (!in_heap(a, run) || (uintptr_t)run % SLAB_RUN != 0 ||
+                !GET_ALLOC(HDRP(run))) {
+                verify_error(s, MM_VERIFY_SLAB, a, -1, run, prev);
+                break;
+            }
+            for (i = 0; i < SLAB_MAP_WORDS; i ++) {
+                nfree += __builtin_popcountll(run->map[i]);
+            }
+            if (pagemap_get(run) != cls + 1 || run->cls != cls ||
+                run->prev != prev || nfree != run->nfree || nfree == 0) {
+                verify_error(s, MM_VERIFY_SLAB, a, -1, run, prev);
+            }
+            prev = run;
+        }
+    }
+}
+#endif
+
+#ifdef MM_THREADS
+/* Threads of mm_verify() besides the caller */
+typedef struct verify_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start;    /* A job is set, or the threads must exit */
+    pthread_cond_t done;     /* No thread is busy */
+    verify_job_t *job;       /* NULL to exit */
+    unsigned int round;      /* Bumped for each job */
+    int busy;                /* Threads still on the job */
+} verify_pool_t;
+
+static void *verify_worker(void *arg) {
+    verify_pool_t *p = arg;
+    unsigned int round = 0;
+
+    for (;;) {
+        verify_job_t *job;
+        pthread_mutex_lock(&p->lock);
+        while (p->round == round) {
+            pthread_cond_wait(&p->start, &p->lock);
+        }
+        round = p->round;
+        job = p->job;
+        pthread_mutex_unlock(&p->lock);
+        if (job == NULL) {
+            return NULL;
+        }
+        verify_run(job);
+        pthread_mutex_lock(&p->lock);
+        if (-- p->busy == 0) {
+            pthread_cond_signal(&p->done);
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+#endif
+
+/*
+ The threads are started before any arena is locked, as starting a thread
+ allocates. Each heap is cut into pieces and checked under its arena lock.
+ Only builds with MM_THREADS run more than one thread.
+ */
+int mm_verify(int nthreads, struct mm_verify_error *errs, int max) {
+    verify_sink_t s = {errs, max, 0};
+    verify_job_t job;
+    int n = __atomic_load_n(&n_arenas, __ATOMIC_ACQUIRE);
+    int i;
+    #ifdef MM_THREADS
+    verify_pool_t pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+        PTHREAD_COND_INITIALIZER, NULL, 0, 0};
+    pthread_t threads[VERIFY_PIECES];
+    int nworkers = 0;
+
+    nthreads = MIN(MAX(nthreads, 1), VERIFY_PIECES);
+    while (nworkers < nthreads - 1 && pthread_create(&threads[nworkers], 
+        NULL, verify_worker, &pool) == 0) {
+        nworkers ++;
+    }
+    #else
+    (void)nthreads;
+    #endif
+
+    job.sink = &s;
+    for (i = 0; i < n; i ++) {
+        arena_t *a = &arenas[i];
+        job.a = a;
+        LOCK_ARENA(a);
+        if (a->heap_listp == 0) {
+            UNLOCK_ARENA(a);
+            continue;
+        }
+        verify_prologue(a, &s);
+        verify_cut(&job);
+        #ifdef MM_THREADS
+        pthread_mutex_lock(&pool.lock);
+        pool.job = &job;
+        pool.busy = nworkers;
+        pool.round ++;
+        pthread_cond_broadcast(&pool.start);
+        pthread_mutex_unlock(&pool.lock);
+        #endif
+        verify_run(&job);
+        #ifdef MM_THREADS
+        pthread_mutex_lock(&pool.lock);
+        while (pool.busy > 0) {
+            pthread_cond_wait(&pool.done, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        #endif
+
+        /* The block the cut stopped at is the epilogue or a bad one */
+        char *end = job.piece[job.npieces];
+        if (GET_SIZE(HDRP(end)) == 0) {
+            verify_epilogue(a, end, &s);
+        } else {
+            verify_block(a, end, job.prev_alloc[job.npieces], 1, &s);
+        }
+        if (job.heap_free != job.list_free) {
+            verify_error(&s, MM_VERIFY_COUNT, a, -1, NULL, NULL);
+        }
+        #ifndef NO_QUICK
+        verify_quick(a, &s);
+        #endif
+        #ifndef NO_SLAB
+        verify_slabs(a, &s);
+        #endif
+        UNLOCK_ARENA(a);
+    }
+
+    #ifdef MM_THREADS
+    pthread_mutex_lock(&pool.lock);
+    pool.job = NULL;
+    pool.round ++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+    for (i = 0; i < nworkers; i ++) {
+        pthread_join(threads[i], NULL);
+    }
+    #endif
+    return s.n;
+}
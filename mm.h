@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdint.h>
 
 #ifdef DRIVER
 
@@ -7,6 +8,9 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
 
 #else
 
@@ -15,10 +19,138 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern int posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *aligned_alloc(size_t alignment, size_t size);
+extern void *memalign(size_t alignment, size_t size);
 
 #endif
 
 extern int mm_init(void);
 
+/* Requests of at least bytes bytes get a mapping of their own. Returns the
+previous threshold. */
+extern size_t mm_set_mmap_threshold(size_t bytes);
+
+/* find_fit() takes the smallest of the first depth fitting blocks of a
+seglist level. Returns the previous depth. */
+extern int mm_set_fit_depth(int depth);
+
+/* Allocate n blocks of size bytes into out. Returns the number allocated,
+less than n only if memory runs out. */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+
+/* Free n pointers at once. The order of ptrs is changed. */
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* Give free memory back to the OS, leaving pad bytes at the top of each heap.
+Returns the number of bytes given back. */
+extern size_t mm_trim(size_t pad);
+
+#define MM_STATS_LEVELS 13 /* Level i counts free blocks of [16 << i, 32 << i)
+                              bytes, and the last level all larger ones */
+#define MM_STATS_SIZES  32 /* Bucket i counts requests of [1 << i, 2 << i)
+                              bytes, and the last bucket all larger ones */
+
+struct mm_stats {
+    size_t live_bytes;    /* Usable bytes of blocks held by the program */
+    size_t heap_bytes;    /* Bytes of all heaps */
+    size_t mapped_bytes;  /* Bytes of blocks mapped on their own */
+    size_t peak_bytes;    /* Most heap and mapped bytes held at once */
+    size_t free_count[MM_STATS_LEVELS]; /* Free blocks per seglist level */
+    size_t free_bytes[MM_STATS_LEVELS]; /* Bytes of the free blocks */
+    size_t requests[MM_STATS_SIZES];    /* Allocations per requested size */
+    size_t splits;        /* Free blocks split to allocate a part */
+    size_t coalesces;     /* Free blocks merged with a neighbour */
+    size_t extends;       /* Times a heap was extended */
+    double fragmentation; /* Share of heap and mapped bytes not live */
+};
+
+/* Fill in stats from counters kept since mm_init(). Threads update their
+counters without a lock, so the sums are only a snapshot. */
+extern void mm_stats(struct mm_stats *stats);
+
+/* A trace written by mm_trace_start() is MM_TRACE_MAGIC followed by records.
+Each thread flushes its records in batches, so they are in order only within
+a thread, and the sequence number of each record, taken from a counter
+shared by all threads, orders all of them. trace2rep converts a trace to a
+.rep file. */
+#define MM_TRACE_MAGIC 0x3345434152544d4dULL /* "MMTRACE3" */
+
+enum mm_trace_op {
+    MM_TRACE_MALLOC,  /* Also posix_memalign() and the like */
+    MM_TRACE_FREE,
+    MM_TRACE_REALLOC,
+    MM_TRACE_CALLOC
+};
+
+struct mm_trace_rec {
+    uint64_t seq;     /* Order of the call among those of all threads */
+    uint64_t ptr;     /* Block returned or freed */
+    uint64_t old;     /* Block passed to realloc(), else 0 */
+    uint64_t size;    /* Bytes asked for, with the op in the top byte */
+};
+
+#define MM_TRACE_OP(r)   ((int)((r)->size >> 56))
+#define MM_TRACE_SIZE(r) ((r)->size & ((1ULL << 56) - 1))
+
+/* Record every call to path until mm_trace_stop(). Only in a build with
+TRACE defined. Returns 0, or -1 with errno set. The interposing build also
+starts when the MM_TRACE environment variable names a file. */
+extern int mm_trace_start(const char *path);
+extern void mm_trace_stop(void);
+
+/* Sample an allocation about every rate bytes with its call stack, until
+rate is 0. Only in a build with PROFILE defined. Returns the previous rate.
+The interposing build also starts when the MM_PROFILE environment variable
+names a prefix for profiles, which SIGUSR2 dumps; MM_PROFILE_RATE sets the
+rate. */
+extern size_t mm_profile_rate(size_t rate);
+
+/* Write the live samples to path as a heap profile that pprof reads.
+Returns 0, or -1 with errno set. */
+extern int mm_profile_dump(const char *path);
+
+/* Write a profile to <prefix>.<pid>.<n>.heap each time signo arrives. */
+extern int mm_profile_signal(int signo, const char *prefix);
+
+enum mm_verify_code {
+    MM_VERIFY_PROLOGUE,   /* Bad prologue block */
+    MM_VERIFY_EPILOGUE,   /* Bad epilogue, or not at the end of the heap */
+    MM_VERIFY_ALIGN,      /* Block not aligned */
+    MM_VERIFY_SIZE,       /* Block below the minimum size or past the heap */
+    MM_VERIFY_FOOTER,     /* Free block whose footer is not its header */
+    MM_VERIFY_PREV_ALLOC, /* Prev-allocated bit wrong for the block in front */
+    MM_VERIFY_COALESCE,   /* Two free blocks next to each other */
+    MM_VERIFY_CLEAN,      /* Allocated block or dirty byte in the clean part */
+    MM_VERIFY_LINK,       /* Seglist link out of the heap, to an allocated
+                             block or not linked back */
+    MM_VERIFY_LEVEL,      /* Free block in the wrong seglist level */
+    MM_VERIFY_ORDER,      /* Seglist level out of order, or tree unbalanced */
+    MM_VERIFY_MAP,        /* Non-empty bit of a level wrong */
+    MM_VERIFY_COUNT,      /* Free blocks in the heap and seglist differ */
+    MM_VERIFY_QUICK,      /* Bad block in a quick list, or bad byte count */
+    MM_VERIFY_SLAB        /* Bad slab run */
+};
+
+struct mm_verify_error {
+    int code;             /* enum mm_verify_code */
+    int arena;            /* Arena whose heap is corrupt */
+    int level;            /* Seglist level, or -1 */
+    void *block;          /* Block at fault, or NULL */
+    void *other;          /* Block it was checked against, or NULL */
+};
+
+/* Check the next budget blocks of the heap of an arena and the next budget
+free blocks of one seglist level, from where the last call stopped in that
+arena. Each call moves on to the next arena. Stores the first max errors in
+errs and returns the number found. */
+extern int mm_verify_step(size_t budget, struct mm_verify_error *errs,
+    int max);
+
+/* Check every heap in full, each cut into pieces at block boundaries that
+nthreads threads check at once. Returns the number of errors like
+mm_verify_step(). */
+extern int mm_verify(int nthreads, struct mm_verify_error *errs, int max);
+
 /* This is largely for debugging. */
 extern void mm_checkheap(int lineno);
@@ -208,6 +208,8 @@ void *realloc(void *ptr, size_t size) {
  * needed to run the traces.
  */
 void *calloc (size_t nmemb, size_t size) {
+    (void)nmemb;
+    (void)size;
     return NULL;
 }
 
@@ -232,6 +234,7 @@ static int aligned(const void *p) {
  * mm_checkheap
  */
 void mm_checkheap(int lineno) {
+    (void)lineno;
 }
 
 static void *coalesce(void *bp) 
@@ -400,8 +403,10 @@ static void printblock(void *bp)
 
 static void checkblock(void *bp) 
 {
-    if ((size_t)bp % 8)
+    if (!aligned(bp))
         printf("Error: %p is not doubleword aligned\n", bp);
+    if (!in_heap(bp))
+        printf("Error: %p is not in the heap\n", bp);
     if (GET(HDRP(bp)) != GET(FTRP(bp)))
         printf("Error: header does not match footer\n");
 }
@@ -0,0 +1,292 @@
+/*
+ mperf.c
+
+ Microbenchmarks of single allocator operations read from the hardware
+ performance counters. For each size class a batch of NBLOCKS blocks is
+ allocated with malloc(), grown to twice the size with realloc() and then
+ freed, and the counters are read around each of the three loops. The
+ results are per call:
+
+     cycles        CPU cycles
+     instr         instructions retired
+     L1d-miss      L1 data cache read misses
+     LLC-miss      last level cache misses
+     dTLB-miss     data TLB read misses
+
+ Counters are opened one at a time with perf_event_open(), for user space
+ only, so a counter the CPU or the kernel does not offer is left out. When
+ no counter can be opened at all (no PMU in a virtual machine, or a
+ perf_event_paranoid setting that forbids it) the cycles come from the time
+ stamp counter instead, and the other columns are empty.
+
+ Usage: mperf [-r <rounds>] [-o <csv>]
+   -r rounds    batches measured per size class and operation (default 20),
+                after one batch to warm up. The median batch is reported.
+   -o csv       append a line per size class and operation to a CSV file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#ifndef ALLOCATOR
+#define ALLOCATOR "mm"
+#endif
+
+#define NBLOCKS   1000  /* Calls in a measured batch */
+#define MAX_ROUNDS 101
+
+enum { CYCLES, INSTR, L1D_MISS, LLC_MISS, DTLB_MISS, NCOUNTERS };
+
+static const char *counter_names[NCOUNTERS] = {
+    "cycles", "instr", "L1d-miss", "LLC-miss", "dTLB-miss"
+};
+
+static int counter_fd[NCOUNTERS];
+static int use_tsc = 0;  /* Cycles from the time stamp counter */
+
+static const size_t sizes[] = {16, 64, 256, 1024, 4096, 16384};
+#define NSIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+enum { OP_MALLOC, OP_REALLOC, OP_FREE, NOPS };
+static const char *op_names[NOPS] = {"malloc", "realloc", "free"};
+
+static char *blocks[NBLOCKS];
+
+/*
+ Open a counter of the calling thread, disabled. Return -1 if it cannot be
+ had.
+ */
+static int open_counter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define CACHE_READ_MISS(cache) ((cache) | \
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static void open_counters(void) {
+    int i, any = 0;
+
+    counter_fd[CYCLES] = open_counter(PERF_TYPE_HARDWARE,
+        PERF_COUNT_HW_CPU_CYCLES);
+    counter_fd[INSTR] = open_counter(PERF_TYPE_HARDWARE,
+        PERF_COUNT_HW_INSTRUCTIONS);
+    counter_fd[L1D_MISS] = open_counter(PERF_TYPE_HW_CACHE,
+        CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D));
+    counter_fd[LLC_MISS] = open_counter(PERF_TYPE_HARDWARE,
+        PERF_COUNT_HW_CACHE_MISSES);
+    counter_fd[DTLB_MISS] = open_counter(PERF_TYPE_HW_CACHE,
+        CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB));
+    for (i = 0; i < NCOUNTERS; i ++) {
+        any |= counter_fd[i] >= 0;
+    }
+    use_tsc = counter_fd[CYCLES] < 0;
+    if (!any) {
+        fprintf(stderr, "mperf: no performance counters, using the time "
+            "stamp counter\n");
+    }
+}
+
+static uint64_t read_tsc(void) {
+    #if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    #endif
+}
+
+static void start_counters(uint64_t *tsc) {
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i ++) {
+        if (counter_fd[i] >= 0) {
+            ioctl(counter_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    *tsc = read_tsc();
+}
+
+/*
+ Stop the counters and store their counts since start_counters() in v,
+ -1 for a counter that is not open
+ */
+static void stop_counters(uint64_t tsc, double *v) {
+    uint64_t end = read_tsc();
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i ++) {
+        uint64_t count;
+
+        v[i] = -1;
+        if (counter_fd[i] >= 0) {
+            ioctl(counter_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counter_fd[i], &count, sizeof(count)) == sizeof(count)) {
+                v[i] = (double)count;
+            }
+        }
+    }
+    if (use_tsc) {
+        v[CYCLES] = (double)(end - tsc);
+    }
+}
+
+/*
+ Run one batch of every op on blocks of size bytes, and store the counts
+ per call in v
+ */
+static void run_batch(size_t size, double v[NOPS][NCOUNTERS]) {
+    uint64_t tsc;
+    int i, k;
+
+    start_counters(&tsc);
+    for (i = 0; i < NBLOCKS; i ++) {
+        blocks[i] = mm_malloc(size);
+    }
+    stop_counters(tsc, v[OP_MALLOC]);
+
+    start_counters(&tsc);
+    for (i = 0; i < NBLOCKS; i ++) {
+        blocks[i] = mm_realloc(blocks[i], 2*size);
+    }
+    stop_counters(tsc, v[OP_REALLOC]);
+
+    start_counters(&tsc);
+    for (i = 0; i < NBLOCKS; i ++) {
+        mm_free(blocks[i]);
+    }
+    stop_counters(tsc, v[OP_FREE]);
+
+    for (i = 0; i < NOPS; i ++) {
+        for (k = 0; k < NCOUNTERS; k ++) {
+            if (v[i][k] >= 0) {
+                v[i][k] /= NBLOCKS;
+            }
+        }
+    }
+}
+
+static int cmp_double(const void *x, const void *y) {
+    double a = *(const double *)x, b = *(const double *)y;
+
+    return a < b ? -1 : a > b;
+}
+
+int main(int argc, char **argv) {
+    static double v[MAX_ROUNDS][NOPS][NCOUNTERS];
+    const char *csv = NULL;
+    FILE *out = NULL;
+    int rounds = 20, c, s, r, op, k;
+
+    while ((c = getopt(argc, argv, "r:o:")) != -1) {
+        switch (c) {
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r <rounds>] [-o <csv>]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (rounds < 1 || rounds > MAX_ROUNDS) {
+        fprintf(stderr, "%s: rounds must be 1 to %d\n", argv[0], MAX_ROUNDS);
+        return 2;
+    }
+    if (csv != NULL) {
+        if ((out = fopen(csv, "a")) == NULL) {
+            perror(csv);
+            return 1;
+        }
+        if (ftell(out) == 0) {
+            fprintf(out, "allocator,size,op,source");
+            for (k = 0; k < NCOUNTERS; k ++) {
+                fprintf(out, ",%s", counter_names[k]);
+            }
+            fprintf(out, "\n");
+        }
+    }
+
+    open_counters();
+    mem_init();
+    printf("Per call on %s, median of %d batches of %d%s:\n", ALLOCATOR,
+        rounds, NBLOCKS, use_tsc ? " (cycles from the time stamp counter)"
+        : "");
+    printf("%6s %-8s", "size", "op");
+    for (k = 0; k < NCOUNTERS; k ++) {
+        printf(" %10s", counter_names[k]);
+    }
+    printf("\n");
+
+    for (s = 0; s < NSIZES; s ++) {
+        double warm[NOPS][NCOUNTERS];
+
+        /* Every size class starts from a fresh heap */
+        mem_reset_brk();
+        mm_init();
+        run_batch(sizes[s], warm);
+        for (r = 0; r < rounds; r ++) {
+            run_batch(sizes[s], v[r]);
+        }
+        for (op = 0; op < NOPS; op ++) {
+            double med[NCOUNTERS];
+
+            for (k = 0; k < NCOUNTERS; k ++) {
+                double col[MAX_ROUNDS];
+                for (r = 0; r < rounds; r ++) {
+                    col[r] = v[r][op][k];
+                }
+                qsort(col, rounds, sizeof(double), cmp_double);
+                med[k] = col[rounds / 2];
+            }
+            printf("%6zu %-8s", sizes[s], op_names[op]);
+            for (k = 0; k < NCOUNTERS; k ++) {
+                if (med[k] < 0) {
+                    printf(" %10s", "-");
+                } else {
+                    printf(" %10.1f", med[k]);
+                }
+            }
+            printf("\n");
+            if (out != NULL) {
+                fprintf(out, "%s,%zu,%s,%s", ALLOCATOR, sizes[s],
+                    op_names[op], use_tsc ? "tsc" : "perf");
+                for (k = 0; k < NCOUNTERS; k ++) {
+                    if (med[k] < 0) {
+                        fprintf(out, ",");
+                    } else {
+                        fprintf(out, ",%.2f", med[k]);
+                    }
+                }
+                fprintf(out, "\n");
+            }
+        }
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+    mem_deinit();
+    return 0;
+}
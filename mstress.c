@@ -0,0 +1,404 @@
+/*
+ mstress.c
+
+ Multi-threaded workloads for the threaded build of mm.c. Each workload
+ runs at 1, 2, 4, ... threads up to -t, and reports ops/sec, the speedup
+ over one thread, the scaling efficiency and the resident set at the end.
+ Efficiency is the speedup over the number of threads that can run at
+ once, the smaller of the threads and the CPUs.
+
+ threadtest  Each thread allocates a batch of small blocks and frees them
+             all, over and over (from Hoard).
+ larson      Each thread replaces random blocks of an array with blocks of
+             random size. After every round the arrays are passed on to
+             the next thread, so most blocks are freed by a thread other
+             than the one that allocated them (from Larson and Krishnan).
+ prodcons    Producer threads allocate blocks and hand them to consumer
+             threads through a queue, which free them.
+ shbench     Each thread allocates blocks of mixed sizes, mostly small, and
+             frees and reallocates them in an irregular order (after the
+             SmartHeap benchmark).
+
+ Every block carries a tag in its first and last bytes, which is checked
+ when it is freed. Build with -DLIBC to run the same workloads against the
+ C library allocator for comparison.
+
+ Usage: mstress [-t <threads>] [-n <ops>] [-o <csv>] [<workload>...]
+   -t threads   most threads to run (default 32)
+   -n ops       allocations per thread per run (default 1000000)
+   -o csv       append a line per run to a CSV file
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef LIBC
+#define ALLOCATOR "libc"
+#define mm_malloc malloc
+#define mm_free free
+#define mm_realloc realloc
+#else
+#define ALLOCATOR "mm"
+#include "mm.h"
+#include "memlib.h"
+#endif
+
+#define MAX_THREADS 64
+#define QUEUE_SIZE  1024    /* Blocks in flight from a producer */
+
+typedef struct worker {
+    pthread_t tid;
+    int id;
+    int nthreads;
+    unsigned long long rnd;  /* State of the random number generator */
+} worker_t;
+
+typedef struct workload {
+    const char *name;
+    void *(*run)(void *);
+} workload_t;
+
+static long nops = 1000000;             /* Allocations per thread */
+static pthread_barrier_t barrier;
+
+/* Arrays of larson, passed on between threads */
+#define LARSON_SLOTS  1000
+#define LARSON_ROUNDS 10
+static char **larson_slots[MAX_THREADS];
+
+/* Queues of prodcons, one per pair of threads */
+typedef struct queue {
+    char *blocks[QUEUE_SIZE];
+    volatile unsigned long head;   /* Next block to take */
+    volatile unsigned long tail;   /* Next free entry */
+    char pad[64];
+} queue_t;
+static queue_t queues[MAX_THREADS / 2 + 1];
+
+static unsigned long long next_rnd(worker_t *w) {
+    w->rnd ^= w->rnd << 13;
+    w->rnd ^= w->rnd >> 7;
+    w->rnd ^= w->rnd << 17;
+    return w->rnd;
+}
+
+/*
+ Allocate size bytes, at least 2, and tag them
+ */
+static char *alloc_tagged(size_t size) {
+    char *p = mm_malloc(size);
+
+    if (p == NULL) {
+        fprintf(stderr, "mstress: out of memory\n");
+        exit(1);
+    }
+    p[0] = (char)size;
+    p[size - 1] = (char)(size >> 8);
+    return p;
+}
+
+/*
+ Check the tag of a block of size bytes and free it
+ */
+static void free_tagged(char *p, size_t size) {
+    if (p[0] != (char)size || p[size - 1] != (char)(size >> 8)) {
+        fprintf(stderr, "mstress: block %p of %zu bytes corrupted\n", p, size);
+        exit(1);
+    }
+    mm_free(p);
+}
+
+/* A block records its size in a header of its own for the workloads that
+pass blocks on */
+#define SIZED_HDR 8
+static char *alloc_sized(size_t size) {
+    char *p = alloc_tagged(size + SIZED_HDR);
+
+    memcpy(p + 1, &size, sizeof(unsigned int));
+    return p;
+}
+
+static void free_sized(char *p) {
+    unsigned int size;
+
+    memcpy(&size, p + 1, sizeof(size));
+    free_tagged(p, size + SIZED_HDR);
+}
+
+static void *threadtest(void *arg) {
+    char *blocks[100];
+    long done;
+    int i;
+
+    (void)arg;
+    for (done = 0; done < nops; done += 100) {
+        for (i = 0; i < 100; i ++) {
+            blocks[i] = alloc_tagged(64);
+        }
+        for (i = 0; i < 100; i ++) {
+            free_tagged(blocks[i], 64);
+        }
+    }
+    return NULL;
+}
+
+static void *larson(void *arg) {
+    worker_t *w = arg;
+    long per_round = nops / LARSON_ROUNDS;
+    int round, i;
+    long k;
+
+    for (i = 0; i < LARSON_SLOTS; i ++) {
+        larson_slots[w->id][i] = alloc_sized(8 + next_rnd(w) % 500);
+    }
+    for (round = 0; round < LARSON_ROUNDS; round ++) {
+        /* Every round works on the array of another thread */
+        char **slots = larson_slots[(w->id + round) % w->nthreads];
+
+        for (k = 0; k < per_round; k ++) {
+            i = next_rnd(w) % LARSON_SLOTS;
+            free_sized(slots[i]);
+            slots[i] = alloc_sized(8 + next_rnd(w) % 500);
+        }
+        pthread_barrier_wait(&barrier);
+    }
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < LARSON_SLOTS; i ++) {
+        free_sized(larson_slots[w->id][i]);
+    }
+    return NULL;
+}
+
+static void *prodcons(void *arg) {
+    worker_t *w = arg;
+    long k;
+
+    if (w->nthreads == 1) {
+        /* Both ends in one thread, a queue at a time */
+        char *blocks[QUEUE_SIZE];
+        int i;
+
+        for (k = 0; k < nops; k += QUEUE_SIZE) {
+            for (i = 0; i < QUEUE_SIZE; i ++) {
+                blocks[i] = alloc_sized(16 + next_rnd(w) % 256);
+            }
+            for (i = 0; i < QUEUE_SIZE; i ++) {
+                free_sized(blocks[i]);
+            }
+        }
+        return NULL;
+    }
+
+    queue_t *q = &queues[w->id / 2];
+    if (w->id % 2 == 0) {
+        for (k = 0; k < nops; k ++) {
+            char *p = alloc_sized(16 + next_rnd(w) % 256);
+            while (q->tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) ==
+                QUEUE_SIZE) {
+                sched_yield();
+            }
+            q->blocks[q->tail % QUEUE_SIZE] = p;
+            __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+        }
+    } else {
+        for (k = 0; k < nops; k ++) {
+            while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->head) {
+                sched_yield();
+            }
+            free_sized(q->blocks[q->head % QUEUE_SIZE]);
+            __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+static void *shbench(void *arg) {
+    worker_t *w = arg;
+    char *blocks[256] = {0};
+    size_t sizes[256];
+    long k;
+    int i;
+
+    for (k = 0; k < nops; k ++) {
+        unsigned long long r = next_rnd(w);
+        size_t size = r % 8 ? 2 + (r >> 8) % 100 : 2 + (r >> 8) % 5000;
+
+        i = (r >> 32) % 256;
+        if (blocks[i] == NULL) {
+            blocks[i] = alloc_tagged(size);
+        } else if ((r >> 40) % 4 == 0) {
+            free_tagged(blocks[i], sizes[i]);
+            blocks[i] = alloc_tagged(size);
+        } else if ((r >> 40) % 4 == 1) {
+            /* The data moves with the block, but the tag is rewritten for
+            the new size */
+            char *p = mm_realloc(blocks[i], size);
+            if (p == NULL) {
+                fprintf(stderr, "mstress: out of memory\n");
+                exit(1);
+            }
+            p[0] = (char)size;
+            p[size - 1] = (char)(size >> 8);
+            blocks[i] = p;
+        } else {
+            free_tagged(blocks[i], sizes[i]);
+            blocks[i] = NULL;
+            continue;
+        }
+        sizes[i] = size;
+    }
+    for (i = 0; i < 256; i ++) {
+        if (blocks[i] != NULL) {
+            free_tagged(blocks[i], sizes[i]);
+        }
+    }
+    return NULL;
+}
+
+static const workload_t workloads[] = {
+    {"threadtest", threadtest},
+    {"larson", larson},
+    {"prodcons", prodcons},
+    {"shbench", shbench},
+};
+#define NWORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+/*
+ Resident set of the process in KB
+ */
+static long rss_kb(void) {
+    FILE *f = fopen("/proc/self/statm", "r");
+    long size, resident = 0;
+
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ Run a workload with n threads and return its allocations per second
+ */
+static double run(const workload_t *wl, int n) {
+    worker_t workers[MAX_THREADS];
+    struct timespec start, end;
+    double secs;
+    int i;
+
+    pthread_barrier_init(&barrier, NULL, n);
+    memset(queues, 0, sizeof(queues));
+    for (i = 0; i < n; i ++) {
+        if (wl->run == larson) {
+            larson_slots[i] = calloc(LARSON_SLOTS, sizeof(char *));
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i ++) {
+        workers[i].id = i;
+        workers[i].nthreads = n;
+        workers[i].rnd = 88172645463325252ULL + 7919 * i;
+        pthread_create(&workers[i].tid, NULL, wl->run, &workers[i]);
+    }
+    for (i = 0; i < n; i ++) {
+        pthread_join(workers[i].tid, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_barrier_destroy(&barrier);
+    for (i = 0; i < n; i ++) {
+        if (wl->run == larson) {
+            free(larson_slots[i]);
+        }
+    }
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+    /* A lone producer has no consumer, so only pairs count */
+    if (wl->run == prodcons && n > 1) {
+        n = n / 2;
+    }
+    return n * nops / secs;
+}
+
+int main(int argc, char **argv) {
+    const char *csv = NULL;
+    FILE *out = NULL;
+    int max_threads = 32, c, k, i, n;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((c = getopt(argc, argv, "t:n:o:")) != -1) {
+        switch (c) {
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            nops = atol(optarg);
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t <threads>] [-n <ops>] [-o <csv>] "
+                "[<workload>...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (max_threads < 1 || max_threads > MAX_THREADS || nops < 1) {
+        fprintf(stderr, "%s: threads must be 1 to %d\n", argv[0], MAX_THREADS);
+        return 2;
+    }
+    if (csv != NULL) {
+        if ((out = fopen(csv, "a")) == NULL) {
+            perror(csv);
+            return 1;
+        }
+        if (ftell(out) == 0) {
+            fprintf(out, "allocator,workload,threads,ops_per_sec,speedup,"
+                "efficiency,rss_kb\n");
+        }
+    }
+
+    #ifndef LIBC
+    mem_init();
+    mm_init();
+    #endif
+    for (k = 0; k < NWORKLOADS; k ++) {
+        const workload_t *wl = &workloads[k];
+        double base = 0;
+
+        if (optind < argc) {
+            for (i = optind; i < argc && strcmp(argv[i], wl->name); i ++) {
+            }
+            if (i == argc) {
+                continue;
+            }
+        }
+        printf("%s on %s (%ld CPUs):\n%8s %14s %8s %10s %10s\n", wl->name,
+            ALLOCATOR, ncpus, "threads", "ops/sec", "speedup", "efficiency",
+            "rss KB");
+        for (n = 1; n <= max_threads; n *= 2) {
+            double rate = run(wl, n);
+            double speedup, efficiency;
+            long rss = rss_kb();
+
+            if (n == 1) {
+                base = rate;
+            }
+            speedup = rate / base;
+            efficiency = speedup / (n < ncpus ? n : ncpus);
+            printf("%8d %14.0f %8.2f %9.0f%% %10ld\n", n, rate, speedup,
+                100 * efficiency, rss);
+            if (out != NULL) {
+                fprintf(out, "%s,%s,%d,%.0f,%.3f,%.3f,%ld\n", ALLOCATOR,
+                    wl->name, n, rate, speedup, efficiency, rss);
+            }
+        }
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+    return 0;
+}
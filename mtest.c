@@ -0,0 +1,357 @@
+/*
+ mtest.c
+
+ Checks of the calls of mm.c that the traces of mdriver do not reach. Each
+ test runs on a fresh heap, and mm_verify() checks the heap after it. A
+ failed check prints its line and the test goes on.
+
+ Usage: mtest [<test>...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#ifdef TRACE
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#include "mm.h"
+#include "memlib.h"
+
+typedef struct test {
+    const char *name;
+    void (*run)(void);
+} test_t;
+
+static int failed = 0;  /* Checks that failed in the current test */
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  line %d: %s\n", __LINE__, #cond); \
+        failed ++; \
+    } \
+} while (0)
+
+/*
+ Return whether the n bytes at p are all c
+ */
+static int all_bytes(const void *p, int c, size_t n) {
+    const unsigned char *b = p;
+    size_t i;
+
+    for (i = 0; i < n; i ++) {
+        if (b[i] != (unsigned char)c) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ A shrunk block stays where it is, by any amount, and keeps its bytes
+ */
+static void test_realloc_shrink(void) {
+    char *p = mm_malloc(4000), *q;
+
+    memset(p, 'a', 4000);
+    q = mm_realloc(p, 2500);
+    CHECK(q == p && all_bytes(q, 'a', 2500));
+    q = mm_realloc(q, 200);
+    CHECK(q == p && all_bytes(q, 'a', 200));
+    q = mm_realloc(q, 1);
+    CHECK(q == p && all_bytes(q, 'a', 1));
+    mm_free(q);
+}
+
+/*
+ A small block resized within what it holds is not moved
+ */
+static void test_realloc_small(void) {
+    char *p = mm_malloc(40), *q;
+
+    memset(p, 'b', 40);
+    q = mm_realloc(p, 24);
+    CHECK(q == p && all_bytes(q, 'b', 24));
+    q = mm_realloc(q, 40);
+    CHECK(q == p && all_bytes(q, 'b', 24));
+    mm_free(q);
+}
+
+/*
+ mm_trim() cuts the heap down to its last allocated block, and the heap
+ grows back afterwards
+ */
+static void test_trim(void) {
+    struct mm_stats before, after;
+    char *keep = mm_malloc(1000), *p = mm_malloc(1 << 20);
+
+    memset(p, 'c', 1 << 20);
+    mm_free(p);
+    mm_stats(&before);
+    CHECK(mm_trim(0) >= (1 << 20) - mem_pagesize());
+    mm_stats(&after);
+    CHECK(after.heap_bytes + (1 << 20) <= before.heap_bytes);
+    p = mm_malloc(1 << 20);
+    CHECK(p != NULL);
+    memset(p, 'c', 1 << 20);
+    mm_free(p);
+    mm_free(keep);
+}
+
+/*
+ calloc() carved out of a free block whose pages mm_trim() dropped gets zero
+ bytes without touching those pages again. Half the block is asked for, as
+ TLSF rounds a request up to the next list.
+ */
+static void test_calloc_trimmed(void) {
+    size_t n = 1 << 20, page = mem_pagesize(), i;
+    char *p = mm_malloc(n), *keep = mm_malloc(1000), *q;
+    unsigned char vec[(1 << 20) / 4096];
+    uintptr_t lo, hi;
+    int resident = 0;
+
+    memset(p, 'e', n);
+    mm_free(p);
+    mm_trim(0);
+    q = mm_calloc(1, n / 2);
+    CHECK(q >= p - page && q < p + page);
+    /* The pages inside the block but for the first and last, checked before
+    reading them maps the zero page in */
+    lo = ((uintptr_t)q + 2*page - 1) & ~(page - 1);
+    hi = ((uintptr_t)q + n / 2 - page) & ~(page - 1);
+    CHECK(mincore((void *)lo, hi - lo, vec) == 0);
+    for (i = 0; i < (hi - lo) / page; i ++) {
+        resident += vec[i] & 1;
+    }
+    CHECK(resident == 0);
+    CHECK(all_bytes(q, 0, n / 2));
+    mm_free(q);
+    mm_free(keep);
+}
+
+/*
+ calloc() from memory a heap grows into for the first time leaves its pages
+ alone, as they are known to be zero; for arena 0, memlib reports which
+ memory that is, whatever the backend. The block is larger
+ than any heap of the other tests, and only its second half is checked, as
+ it may start in a free block of the heap.
+ */
+static void test_calloc_fresh(void) {
+    size_t n = 8 << 20, page = mem_pagesize(), i;
+    static unsigned char vec[(8 << 20) / 4096];
+    char *q = mm_calloc(1, n);
+    uintptr_t lo, hi;
+    int resident = 0;
+
+    CHECK(q != NULL);
+    if (q == NULL) {
+        return;
+    }
+    lo = ((uintptr_t)q + n / 2) & ~(page - 1);
+    hi = ((uintptr_t)q + n - page) & ~(page - 1);
+    CHECK(mincore((void *)lo, hi - lo, vec) == 0);
+    for (i = 0; i < (hi - lo) / page; i ++) {
+        resident += vec[i] & 1;
+    }
+    /* mmap-populate faults the pages in as it commits them, and the heap
+    checker of a DEBUG build reads free memory above clean_lo */
+    #ifndef DEBUG
+    CHECK(resident == 0 || strcmp(mem_backend_name(), "mmap-populate") == 0);
+    #endif
+    CHECK(all_bytes(q, 0, n));
+    mm_free(q);
+}
+
+/*
+ posix_memalign() takes only a power of 2 that is a multiple of
+ sizeof(void *), and leaves *memptr alone when it refuses
+ */
+static void test_memalign_args(void) {
+    void *p = (void *)&failed, *q;
+
+    CHECK(mm_posix_memalign(&p, 0, 16) == EINVAL && p == (void *)&failed);
+    CHECK(mm_posix_memalign(&p, sizeof(void *) / 2, 16) == EINVAL);
+    CHECK(mm_posix_memalign(&p, 3 * sizeof(void *), 16) == EINVAL);
+    CHECK(p == (void *)&failed);
+    CHECK(mm_posix_memalign(&q, 4096, 100) == 0);
+    CHECK(q != NULL && ((uintptr_t)q & 4095) == 0);
+    mm_free(q);
+}
+
+/*
+ An aligned request of at least the mmap threshold gets a mapping of its
+ own, at any alignment, which free() and realloc() handle as any mapping
+ */
+static void test_memalign_mapped(void) {
+    size_t aligns[] = {64, 4096, 1 << 21}, n = 2 << 20, old;
+    struct mm_stats before, after;
+    char *p;
+    int i;
+
+    /* The driver build maps nothing unless asked to */
+    old = mm_set_mmap_threshold(n);
+    mm_stats(&before);
+    for (i = 0; i < 3; i ++) {
+        p = mm_memalign(aligns[i], n);
+        CHECK(p != NULL && ((uintptr_t)p & (aligns[i] - 1)) == 0);
+        if (p == NULL) {
+            continue;
+        }
+        memset(p, 'f', n);
+        mm_stats(&after);
+        CHECK(after.heap_bytes == before.heap_bytes);
+        #ifndef NO_STATS
+        CHECK(after.mapped_bytes >= before.mapped_bytes + n);
+        #endif
+        p = mm_realloc(p, 2*n);
+        CHECK(p != NULL && all_bytes(p, 'f', n));
+        mm_free(p);
+    }
+    #ifndef NO_STATS
+    mm_stats(&after);
+    CHECK(after.mapped_bytes == before.mapped_bytes);
+    #endif
+    mm_set_mmap_threshold(old);
+}
+
+#ifdef TRACE
+#define TRACE_BLOCKS 64
+
+static int rec_cmp(const void *x, const void *y) {
+    const struct mm_trace_rec *a = x, *b = y;
+
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/* Free the blocks of another thread and allocate as many again */
+static void *trace_worker(void *arg) {
+    void **blocks = arg;
+    int i;
+
+    for (i = 0; i < TRACE_BLOCKS; i ++) {
+        mm_free(blocks[i]);
+    }
+    for (i = 0; i < TRACE_BLOCKS; i ++) {
+        blocks[i] = mm_malloc(48);
+    }
+    return NULL;
+}
+
+/*
+ In sequence order, the records of two threads that hand blocks to each
+ other free every address before it is allocated again
+ */
+static void test_trace_order(void) {
+    char path[] = "/tmp/mtest-trace-XXXXXX";
+    struct mm_trace_rec recs[4*TRACE_BLOCKS + 1];
+    uint64_t live[2*TRACE_BLOCKS], magic = 0;
+    void *blocks[TRACE_BLOCKS];
+    int fd, i, j, n, nlive = 0;
+    FILE *f;
+
+    CHECK((fd = mkstemp(path)) >= 0);
+    close(fd);
+    CHECK(mm_trace_start(path) == 0);
+    for (i = 0; i < TRACE_BLOCKS; i ++) {
+        blocks[i] = mm_malloc(48);
+    }
+    #ifdef MM_THREADS
+    {
+        pthread_t t;
+        CHECK(pthread_create(&t, NULL, trace_worker, blocks) == 0);
+        pthread_join(t, NULL);
+    }
+    #else
+    trace_worker(blocks);
+    #endif
+    for (i = 0; i < TRACE_BLOCKS; i ++) {
+        mm_free(blocks[i]);
+    }
+    mm_trace_stop();
+
+    f = fopen(path, "rb");
+    unlink(path);
+    CHECK(f != NULL);
+    if (f == NULL) {
+        return;
+    }
+    CHECK(fread(&magic, sizeof(magic), 1, f) == 1 && magic == MM_TRACE_MAGIC);
+    n = (int)fread(recs, sizeof(recs[0]), 4*TRACE_BLOCKS + 1, f);
+    fclose(f);
+    CHECK(n == 4*TRACE_BLOCKS);
+    qsort(recs, n, sizeof(recs[0]), rec_cmp);
+    for (i = 0; i < n; i ++) {
+        for (j = 0; j < nlive && live[j] != recs[i].ptr; j ++)
+            ;
+        if (MM_TRACE_OP(&recs[i]) == MM_TRACE_FREE) {
+            CHECK(j < nlive);
+            if (j < nlive) {
+                live[j] = live[-- nlive];
+            }
+        } else {
+            CHECK(j == nlive);
+            live[nlive ++] = recs[i].ptr;
+        }
+        CHECK(i == 0 || recs[i].seq > recs[i - 1].seq);
+    }
+    CHECK(nlive == 0);
+}
+#endif
+
+static const test_t tests[] = {
+    {"realloc_shrink", test_realloc_shrink},
+    {"realloc_small", test_realloc_small},
+    {"trim", test_trim},
+    {"calloc_trimmed", test_calloc_trimmed},
+    {"calloc_fresh", test_calloc_fresh},
+    {"memalign_args", test_memalign_args},
+    {"memalign_mapped", test_memalign_mapped},
+#ifdef TRACE
+    {"trace_order", test_trace_order},
+#endif
+};
+#define NTESTS (int)(sizeof(tests) / sizeof(tests[0]))
+
+/*
+ Run a test on a fresh heap. Return 0 if it passed.
+ */
+static int run(const test_t *t) {
+    struct mm_verify_error errs[4];
+    int nerrs, i;
+
+    mem_reset_brk();
+    mm_init();
+    failed = 0;
+    t->run();
+    nerrs = mm_verify(1, errs, 4);
+    for (i = 0; i < nerrs && i < 4; i ++) {
+        printf("  heap error %d at %p\n", errs[i].code, errs[i].block);
+    }
+    printf("%-24s %s\n", t->name, failed || nerrs ? "FAIL" : "ok");
+    return failed || nerrs;
+}
+
+int main(int argc, char **argv) {
+    int nfailed = 0, i, k;
+
+    mem_init();
+    if (argc == 1) {
+        for (i = 0; i < NTESTS; i ++) {
+            nfailed += run(&tests[i]);
+        }
+    }
+    for (k = 1; k < argc; k ++) {
+        for (i = 0; i < NTESTS && strcmp(tests[i].name, argv[k]) != 0; i ++)
+            ;
+        if (i == NTESTS) {
+            fprintf(stderr, "%s: no test %s\n", argv[0], argv[k]);
+            return 2;
+        }
+        nfailed += run(&tests[i]);
+    }
+    mem_deinit();
+    return nfailed > 0;
+}
@@ -0,0 +1,268 @@
+/*
+ trace2rep.c
+
+ Convert a binary trace written by mm_trace_start() into the .rep text the
+ driver reads:
+
+     <suggested heap size>
+     <number of ids>
+     <number of ops>
+     <weight>
+     a <id> <bytes>
+     r <id> <bytes>
+     f <id>
+
+ Every record carries a sequence number from one counter shared by all
+ threads, and the records are replayed in that order. A free() takes its
+ number before the block is released and an allocation after the block is
+ taken, so a block is always freed before its address is handed out again.
+ Every block gets an id of its own, which a realloc() carries over to the
+ new block. A .rep file has no calloc, so a calloc() becomes an allocation
+ of its total bytes. A free() of a block allocated before recording started
+ is dropped, and a realloc() of one becomes an allocation.
+
+ An allocation at the address of a block still live means a record was lost,
+ as when a call races with mm_trace_stop(). The old block is dropped, and
+ the .rep is written but the exit status is 1.
+
+ Usage: trace2rep <trace> [<rep>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mm.h"
+
+/* Table from the address of a live block to its id, open addressing */
+typedef struct slot {
+    uint64_t ptr;     /* 0 if empty */
+    long id;          /* -1 if the slot was removed */
+} slot_t;
+
+static slot_t *table;
+static size_t table_size;  /* A power of 2 */
+static size_t table_used;  /* Slots not empty, removed ones included */
+
+static size_t hash(uint64_t ptr) {
+    return (size_t)((ptr >> 3) * 0x9e3779b97f4a7c15ULL) & (table_size - 1);
+}
+
+static void table_put(uint64_t ptr, long id);
+
+/*
+ Rebuild the table without removed slots, twice as large if it is more than
+ a quarter full of live blocks
+ */
+static void table_grow(void) {
+    slot_t *old = table;
+    size_t old_size = table_size, live = 0, i;
+
+    for (i = 0; i < old_size; i ++) {
+        live += old[i].ptr != 0 && old[i].id >= 0;
+    }
+    table_size = old_size == 0 ? 1024 : 
+        (4*live > old_size ? 2*old_size : old_size);
+    table = calloc(table_size, sizeof(slot_t));
+    if (table == NULL) {
+        fprintf(stderr, "trace2rep: out of memory\n");
+        exit(1);
+    }
+    table_used = 0;
+    for (i = 0; i < old_size; i ++) {
+        if (old[i].ptr != 0 && old[i].id >= 0) {
+            table_put(old[i].ptr, old[i].id);
+        }
+    }
+    free(old);
+}
+
+static slot_t *table_find(uint64_t ptr) {
+    size_t i = hash(ptr);
+
+    while (table[i].ptr != 0) {
+        if (table[i].ptr == ptr && table[i].id >= 0) {
+            return &table[i];
+        }
+        i = (i + 1) & (table_size - 1);
+    }
+    return NULL;
+}
+
+static void table_put(uint64_t ptr, long id) {
+    size_t i;
+
+    if (2*(table_used + 1) > table_size) {
+        table_grow();
+    }
+    i = hash(ptr);
+    while (table[i].ptr != 0) {
+        i = (i + 1) & (table_size - 1);
+    }
+    table[i].ptr = ptr;
+    table[i].id = id;
+    table_used ++;
+}
+
+static struct mm_trace_rec *recs;
+
+static FILE *ops;            /* The ops, until their count is known */
+static long nids = 0, nops = 0, clashes = 0;
+static long long live = 0, peak = 0;
+static long long *sizes = NULL;     /* Bytes of each id */
+static size_t sizes_cap = 0;
+
+static void *xrealloc(void *p, size_t n) {
+    if ((p = realloc(p, n)) == NULL) {
+        fprintf(stderr, "trace2rep: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ Order records by sequence number
+ */
+static int rec_cmp(const void *x, const void *y) {
+    const struct mm_trace_rec *a = x, *b = y;
+
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/*
+ Forget the block at ptr, if any, whose free() was not recorded. Return
+ whether there was one.
+ */
+static int forget(uint64_t ptr) {
+    slot_t *s = table_find(ptr);
+
+    if (s == NULL) {
+        return 0;
+    }
+    live -= sizes[s->id];
+    s->id = -1;
+    return 1;
+}
+
+/*
+ Write the op of a record, if it makes one
+ */
+static void emit(const struct mm_trace_rec *r, const char *name) {
+    long long size = (long long)MM_TRACE_SIZE(r);
+    int op = MM_TRACE_OP(r);
+    slot_t *s;
+    long id;
+
+    if (op == MM_TRACE_REALLOC && table_find(r->old) == NULL) {
+        op = MM_TRACE_MALLOC;
+    }
+    switch (op) {
+    case MM_TRACE_MALLOC:
+    case MM_TRACE_CALLOC:
+        clashes += forget(r->ptr);
+        id = nids ++;
+        if ((size_t)id == sizes_cap) {
+            sizes_cap = sizes_cap ? 2*sizes_cap : 4096;
+            sizes = xrealloc(sizes, sizes_cap * sizeof(*sizes));
+        }
+        sizes[id] = size;
+        live += size;
+        table_put(r->ptr, id);
+        fprintf(ops, "a %ld %lld\n", id, size);
+        break;
+    case MM_TRACE_FREE:
+        if ((s = table_find(r->ptr)) == NULL) {
+            return;
+        }
+        id = s->id;
+        s->id = -1;
+        live -= sizes[id];
+        fprintf(ops, "f %ld\n", id);
+        break;
+    case MM_TRACE_REALLOC:
+        s = table_find(r->old);
+        id = s->id;
+        s->id = -1;
+        if (r->ptr != r->old) {
+            clashes += forget(r->ptr);
+        }
+        live += size - sizes[id];
+        sizes[id] = size;
+        table_put(r->ptr, id);
+        fprintf(ops, "r %ld %lld\n", id, size);
+        break;
+    default:
+        fprintf(stderr, "%s: bad op %d\n", name, op);
+        exit(1);
+    }
+    nops ++;
+    peak = live > peak ? live : peak;
+}
+
+int main(int argc, char **argv) {
+    FILE *in, *out;
+    size_t nrecs = 0, cap = 0, i;
+    uint64_t magic;
+    int c;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <trace> [<rep>]\n", argv[0]);
+        return 2;
+    }
+    if ((in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fread(&magic, sizeof(magic), 1, in) != 1 || magic != MM_TRACE_MAGIC) {
+        fprintf(stderr, "%s: not a trace\n", argv[1]);
+        return 1;
+    }
+    for (;;) {
+        if (nrecs == cap) {
+            cap = cap ? 2*cap : 4096;
+            recs = xrealloc(recs, cap * sizeof(*recs));
+        }
+        if (fread(&recs[nrecs], sizeof(*recs), 1, in) != 1) {
+            break;
+        }
+        nrecs ++;
+    }
+    fclose(in);
+    qsort(recs, nrecs, sizeof(*recs), rec_cmp);
+
+    /* The header needs the counts, so the ops go to a temporary file */
+    if ((ops = tmpfile()) == NULL) {
+        perror("tmpfile");
+        return 1;
+    }
+    table_grow();
+    for (i = 0; i < nrecs; i ++) {
+        emit(&recs[i], argv[1]);
+    }
+
+    if (argc == 3) {
+        if ((out = fopen(argv[2], "w")) == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+    } else {
+        out = stdout;
+    }
+    fprintf(out, "%lld\n%ld\n%ld\n1\n", peak, nids, nops);
+    rewind(ops);
+    while ((c = getc(ops)) != EOF) {
+        putc(c, out);
+    }
+    fclose(ops);
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(recs);
+    free(sizes);
+    free(table);
+    if (clashes > 0) {
+        fprintf(stderr, "%s: %ld allocations of a block still live\n",
+            argv[1], clashes);
+        return 1;
+    }
+    return 0;
+}